@@ -1,8 +1,22 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 /** GAME GRIDS *****************************************************************
  * A grid is represented as a single 16bit number where the 9 most significant
@@ -19,6 +33,7 @@ typedef uint16_t Grid;
 const Grid empty_grid = 0b0000000000000000;
 const Grid winning_grid = 0b0000000111101111;
 const Grid error_grid = 0b1111111111111111;
+const Grid full_grid = 0b0000000111111111;
 
 const Grid cell1 = 0b0000000100000000;
 const Grid cell2 = 0b0000000010000000;
@@ -93,6 +108,42 @@ static Grid explode(Grid grid, int cell) {
   }
 }
 
+/**
+ * Returns the cells toggled when exploding the given cell, or the empty grid if
+ * the cell is invalid.
+ */
+static Grid move_mask(int cell) {
+  // In the full grid every cell is a star, so exploding any of them works.
+  return explode(full_grid, cell) ^ full_grid;
+}
+
+/**
+ * Two moves commute if neither toggles the other's cell: each is still a star
+ * after the other is made, and the grid ends up the same in either order. So
+ * of all the orders of a run of commuting moves a search only needs to try
+ * one, the one where they're made in ascending order.
+ *
+ * Sets `forbidden_after[i]` to the moves that don't need to be tried right
+ * after move `i`, as a bitmap where move `j` is the bit `j - 1`: those smaller
+ * than `i` that commute with it. No move is forbidden at the start, that is
+ * after move 0.
+ *
+ * Swapping two commuting moves never makes a path longer, and a shortest path
+ * can't go through the winning grid before its end, so there's always a
+ * shortest path that respects this order.
+ */
+static void find_commuting_moves(uint16_t forbidden_after[10]) {
+  forbidden_after[0] = 0;
+  for (int i = 1; i <= 9; i++) {
+    forbidden_after[i] = 0;
+    for (int j = 1; j < i; j++) {
+      if (!is_star(move_mask(i), j) && !is_star(move_mask(j), i)) {
+        forbidden_after[i] |= 1 << (j - 1);
+      }
+    }
+  }
+}
+
 static Outcome outcome(Grid grid) {
   if (grid == empty_grid) {
     return Lost;
@@ -103,6 +154,79 @@ static Outcome outcome(Grid grid) {
   }
 }
 
+/** ALLOCATIONS ***************************************************************
+ * All heap allocations go through `star_malloc`, `star_calloc` and
+ * `star_realloc` so that we can keep track of how many there are. When the
+ * policy is set to `TrapAllocations` any allocation is treated as a bug and
+ * aborts the program: this is how we make sure that a solve that should never
+ * touch the heap really doesn't.
+ *
+ * Counters are per thread so that each thread only sees its own allocations.
+ */
+
+typedef enum AllocationPolicy {
+  AllowAllocations,
+  TrapAllocations
+} AllocationPolicy;
+
+static _Thread_local AllocationPolicy allocation_policy = AllowAllocations;
+static _Thread_local long allocations = 0;
+static _Thread_local long allocated_bytes = 0;
+
+static void account_allocation(size_t size) {
+  if (allocation_policy == TrapAllocations) {
+    fprintf(stderr, "Unexpected allocation of %zu bytes\n", size);
+    abort();
+  }
+  allocations++;
+  allocated_bytes += size;
+}
+
+static void *star_malloc(size_t size) {
+  account_allocation(size);
+  return malloc(size);
+}
+
+static void *star_calloc(size_t count, size_t size) {
+  account_allocation(count * size);
+  return calloc(count, size);
+}
+
+static void *star_realloc(void *pointer, size_t size) {
+  account_allocation(size);
+  return realloc(pointer, size);
+}
+
+/** SOLVE STATISTICS **********************************************************
+ * Each engine records how much work its last solve took in `solve_stats`, so
+ * that callers can keep an eye on it without having to thread an extra argument
+ * through every engine. Like the allocation counters, these are per thread.
+ */
+
+typedef struct SolveStats {
+  // Grids taken out of the frontier (or table entries followed) and the
+  // largest number of grids waiting in the frontier at once.
+  uint32_t nodes;
+  uint32_t frontier_peak;
+  // The largest number of `Path` nodes alive at once.
+  uint32_t paths_peak;
+} SolveStats;
+
+static _Thread_local SolveStats solve_stats;
+static _Thread_local uint32_t live_paths = 0;
+
+static void reset_solve_stats() {
+  solve_stats.nodes = 0;
+  solve_stats.frontier_peak = 0;
+  solve_stats.paths_peak = live_paths;
+}
+
+static void record_frontier(uint32_t frontier) {
+  if (frontier > solve_stats.frontier_peak) {
+    solve_stats.frontier_peak = frontier;
+  }
+}
+
 /**
  * A sequence of moves leading to a winning configuration.
  * We treat it as an immutable, shared, reference-counted, singly linked list.
@@ -159,6 +283,7 @@ static void drop_reference_to_path(Path *path) {
     // shared by anyone. This is exactly what we want to not leak memory.
     drop_reference_to_path(path->rest);
     free(path);
+    live_paths--;
   }
 }
 
@@ -176,13 +301,16 @@ static void inc_reference_to_path(Path *path) {
  * This is O(1) space and time.
  */
 static Path *add_move_to_path(Path *path, int move) {
-  Path *new_path = (Path *)malloc(sizeof(Path));
+  Path *new_path = (Path *)star_malloc(sizeof(Path));
   if (new_path == NULL) {
     return NULL;
   }
 
   new_path->move = move;
   new_path->references = 1;
+  if (++live_paths > solve_stats.paths_peak) {
+    solve_stats.paths_peak = live_paths;
+  }
 
   // Since this new node is referencing the `path` we have to increase the
   // references to it.
@@ -213,7 +341,7 @@ typedef struct Queue {
  * Creates a new empty queue.
  */
 static Queue *new_queue() {
-  Queue *queue = (Queue *)malloc(sizeof(Queue));
+  Queue *queue = (Queue *)star_malloc(sizeof(Queue));
   if (queue != NULL) {
     queue->first = NULL;
     queue->last = NULL;
@@ -249,7 +377,7 @@ static void push_front(Queue *queue, Path *path, Grid grid) {
     return;
   }
 
-  QueueNode *new_first = (QueueNode *)malloc(sizeof(QueueNode));
+  QueueNode *new_first = (QueueNode *)star_malloc(sizeof(QueueNode));
   if (new_first == NULL) {
     return;
   }
@@ -312,7 +440,7 @@ static Path *shortest_winning_path(Grid initial) {
   //
   // Each grid has 9 slots that can take 2 different states, so there's only
   // 512 possible grids.
-  char *visited = (char *)calloc(512, sizeof(bool));
+  char *visited = (char *)star_calloc(512, sizeof(bool));
   Queue *to_visit = new_queue();
   if (visited == NULL || to_visit == NULL) {
     free(visited);
@@ -320,6 +448,16 @@ static Path *shortest_winning_path(Grid initial) {
     return NULL;
   }
 
+  // Moves that commute only need to be tried in one order (see
+  // `find_commuting_moves`). A grid can be reached with different last moves
+  // though, and we visit it only once: so we only skip a move if it's
+  // forbidden after all the moves that reached the grid.
+  uint16_t forbidden_after[10];
+  uint16_t forbidden[512];
+  find_commuting_moves(forbidden_after);
+  memset(forbidden, 0xFF, sizeof(forbidden));
+  forbidden[initial] = 0;
+
   // We start with just the initial grid as the only node to visit.
   // Note how we push all nodes at the front of the queue and get the next node
   // to visit from the back! This means we're always visiting the nodes closest
@@ -327,11 +465,16 @@ static Path *shortest_winning_path(Grid initial) {
   push_front(to_visit, new_path(), initial);
   QueueNode *node = NULL;
   Path *winning_path = NULL;
+  uint32_t queued = 1;
+  reset_solve_stats();
+  record_frontier(queued);
 
   while ((node = pop_back(to_visit)) != NULL) {
     // We record that the node has been visited, so we won't visit it again in
     // future iterations.
     visited[node->grid] = true;
+    solve_stats.nodes++;
+    queued--;
 
     Outcome grid_outcome = outcome(node->grid);
     if (grid_outcome == Won) {
@@ -343,7 +486,8 @@ static Path *shortest_winning_path(Grid initial) {
       // Otherwise we go throug all the grids that can be reached from this one
       // by making a star explode:
       for (int i = 1; i <= 9; i++) {
-        if (is_star(node->grid, i)) {
+        if (is_star(node->grid, i) &&
+            !(forbidden[node->grid] & (1 << (i - 1)))) {
           Grid new_grid = explode(node->grid, i);
           if (!visited[new_grid]) {
             // If this new grid hasn't been visited yet we add it to the back of
@@ -351,6 +495,8 @@ static Path *shortest_winning_path(Grid initial) {
             // that got us there.
             Path *new_path = add_move_to_path(node->path, i);
             push_front(to_visit, new_path, new_grid);
+            forbidden[new_grid] &= forbidden_after[i];
+            record_frontier(++queued);
           }
         }
       }
@@ -371,87 +517,6135 @@ static Path *shortest_winning_path(Grid initial) {
   return winning_path;
 }
 
-/** PRINTING AND PARSING ******************************************************/
+/** SOLVING WITHOUT ALLOCATIONS ***********************************************
+ * `shortest_winning_path` allocates a node for each grid it visits and for each
+ * move it adds to a path. That's fine most of the time, but if we want to be
+ * sure a solve never touches the heap all the memory it needs has to be
+ * reserved beforehand: this is what a `SolverContext` is for.
+ *
+ * A context can live anywhere (on the stack, in a global, on the heap) and can
+ * be reused for any number of solves. Each grid is visited at most once, so we
+ * never need more than 512 slots for the queue and the moves that led to each
+ * grid. Instead of clearing `visited_in` before each solve we bump a
+ * generation counter: a grid is visited if it was marked with the current one.
+ */
 
-static void print_grid(Grid grid) {
-  printf("%c%c%c\n%c%c%c\n%c%c%c", cell1 & grid ? '*' : '.',
-         cell2 & grid ? '*' : '.', cell3 & grid ? '*' : '.',
-         cell4 & grid ? '*' : '.', cell5 & grid ? '*' : '.',
-         cell6 & grid ? '*' : '.', cell7 & grid ? '*' : '.',
-         cell8 & grid ? '*' : '.', cell9 & grid ? '*' : '.');
+typedef struct SolverContext {
+  uint32_t generation;
+  uint32_t visited_in[512];
+  Grid queue[512];
+  // The grid we came from and the move we made to get to each visited grid.
+  Grid parent[512];
+  unsigned char move[512];
+  // The moves we can skip from each visited grid, and after each move, see
+  // `shortest_winning_path`.
+  uint16_t forbidden[512];
+  uint16_t forbidden_after[10];
+} SolverContext;
+
+static void init_solver_context(SolverContext *context) {
+  memset(context, 0, sizeof(SolverContext));
+  find_commuting_moves(context->forbidden_after);
 }
 
 /**
- * Prints a full text explanation of the sequence of moves leading to victory
- * from a given initial grid.
- * This is a bit verbose and shows all intermediate steps.
+ * Finds the shortest sequence of moves leading from `initial` to the winning
+ * grid using only the memory in the context. The moves are written in `moves`
+ * in the order they have to be made; there can be at most 511 of them.
+ *
+ * Returns the number of moves, or -1 if there's no way to win.
  */
-static void print_path_loop(Path *path) {
-  if (path == NULL) {
-    return;
+static int shortest_winning_moves(SolverContext *context, Grid initial,
+                                  int moves[511]) {
+  uint32_t generation = ++context->generation;
+  if (generation == 0) {
+    // The counter wrapped around, old marks would look like new ones so we
+    // have to clear them for real.
+    memset(context->visited_in, 0, sizeof(context->visited_in));
+    generation = context->generation = 1;
   }
-  print_path_loop(path->rest);
-  printf("%d\n", path->move);
+
+  int first = 0;
+  int last = 0;
+  context->queue[last++] = initial;
+  context->visited_in[initial] = generation;
+  context->forbidden[initial] = 0;
+  bool won = false;
+  reset_solve_stats();
+
+  while (first < last && !won) {
+    record_frontier(last - first);
+    Grid grid = context->queue[first++];
+    solve_stats.nodes++;
+    Outcome grid_outcome = outcome(grid);
+    if (grid_outcome == Won) {
+      won = true;
+    } else if (grid_outcome == Continue) {
+      for (int i = 1; i <= 9; i++) {
+        Grid new_grid = explode(grid, i);
+        if (!is_star(grid, i) || (context->forbidden[grid] & (1 << (i - 1)))) {
+          continue;
+        } else if (context->visited_in[new_grid] != generation) {
+          context->visited_in[new_grid] = generation;
+          context->parent[new_grid] = grid;
+          context->move[new_grid] = i;
+          context->forbidden[new_grid] = context->forbidden_after[i];
+          context->queue[last++] = new_grid;
+        } else {
+          // Reached again, maybe with a different last move. If the grid was
+          // already expanded this doesn't matter anymore.
+          context->forbidden[new_grid] &= context->forbidden_after[i];
+        }
+      }
+    }
+  }
+
+  if (!won) {
+    return -1;
+  }
+
+  // We walk back from the winning grid to the initial one, this gives us the
+  // moves in reverse order so we flip them once we're done.
+  int length = 0;
+  for (Grid grid = winning_grid; grid != initial;
+       grid = context->parent[grid]) {
+    moves[length++] = context->move[grid];
+  }
+  for (int i = 0; i < length / 2; i++) {
+    int move = moves[i];
+    moves[i] = moves[length - 1 - i];
+    moves[length - 1 - i] = move;
+  }
+  return length;
 }
 
-static void print_path(Path *path) {
-  if (path == NULL) {
-    printf("-1");
-  } else {
-    print_path_loop(path);
+/** SOLUTION TABLE ************************************************************
+ * Running a brand new bfs for every query is wasteful when queries keep
+ * touching the same grids over and over. A solution table remembers, for each
+ * grid, whether we know it can be won, how many moves that takes and which
+ * move gets us one step closer to the winning grid.
+ *
+ * The table is filled lazily:
+ * - every search teaches it about all the grids along the winning path it
+ *   found, or about all the grids it visited if there was no winning path;
+ * - it can be extended one bfs layer at a time, going backwards from the
+ *   `winning_grid`, whenever there's some idle time to spend.
+ *
+ * It can be written to a file and loaded back later, so that it keeps getting
+ * better across restarts. Since a broken table could send `follow_table`
+ * around in circles, tables are checked when they're loaded.
+ */
+
+typedef enum Knowledge { Unknown, Solvable, Unsolvable } Knowledge;
+
+typedef struct SolutionTable {
+  unsigned char knowledge[512];
+  unsigned char next_move[512];
+  unsigned char distance[512];
+  // All grids that are at most `complete_layers` moves away from the winning
+  // grid are guaranteed to be in the table. Once `complete` is true every
+  // single grid is.
+  int complete_layers;
+  bool complete;
+} SolutionTable;
+
+static const char solution_table_magic[8] = {'S', 'T', 'A', 'R',
+                                             'T', 'A', 'B', '2'};
+
+#define SOLUTION_TABLE_BYTES (4 + 1 + 512 * 3)
+
+/**
+ * Creates a new table that only knows about the two grids where the game is
+ * already over.
+ */
+static SolutionTable *new_solution_table() {
+  SolutionTable *table = (SolutionTable *)star_calloc(1, sizeof(SolutionTable));
+  if (table != NULL) {
+    table->knowledge[winning_grid] = Solvable;
+    table->knowledge[empty_grid] = Unsolvable;
   }
+  return table;
+}
+
+static int path_length(Path *path) {
+  int length = 0;
+  for (; path != NULL; path = path->rest) {
+    length++;
+  }
+  return length;
 }
 
 /**
- * Turns a string into a grid.
- * Returns an `error_grid` if the given string contains invalid characters or
- * more characters than expected.
+ * Records in the table all the grids found along a shortest winning path
+ * starting from `initial`.
+ * Any piece of a shortest path is a shortest path itself, so each of those
+ * grids is exactly as far from victory as the number of moves left.
  */
-static Grid parse(char *input) {
-  char a, b, c, d, e, f, g, h, i;
-  if (strlen(input) != 11) {
-    return error_grid;
+static void learn_from_path(SolutionTable *table, Grid initial, Path *path) {
+  int moves[512];
+  int length = 0;
+  for (; path != NULL && length < 512; path = path->rest) {
+    moves[length++] = path->move;
   }
 
-  sscanf(input, "%c%c%c\n%c%c%c\n%c%c%c", &a, &b, &c, &d, &e, &f, &g, &h, &i);
+  // Remember the path is in reverse order, so the first move is the last one
+  // in the array.
+  Grid grid = initial;
+  for (int i = length - 1; i >= 0; i--) {
+    table->knowledge[grid] = Solvable;
+    table->next_move[grid] = moves[i];
+    table->distance[grid] = i + 1;
+    grid = explode(grid, moves[i]);
+  }
+}
 
-  Grid grid = empty_grid;
-  grid = a == '*' ? (cell1 | grid) : (a == '.' ? grid : error_grid);
-  grid = b == '*' ? (cell2 | grid) : (b == '.' ? grid : error_grid);
-  grid = c == '*' ? (cell3 | grid) : (c == '.' ? grid : error_grid);
-  grid = d == '*' ? (cell4 | grid) : (d == '.' ? grid : error_grid);
-  grid = e == '*' ? (cell5 | grid) : (e == '.' ? grid : error_grid);
-  grid = f == '*' ? (cell6 | grid) : (f == '.' ? grid : error_grid);
-  grid = g == '*' ? (cell7 | grid) : (g == '.' ? grid : error_grid);
-  grid = h == '*' ? (cell8 | grid) : (h == '.' ? grid : error_grid);
-  grid = i == '*' ? (cell9 | grid) : (i == '.' ? grid : error_grid);
-  return grid;
+/**
+ * Extends the given path with the moves the table knows will lead from `grid`
+ * to the winning grid. The caller's reference to `path` is taken over by the
+ * returned path.
+ */
+static Path *follow_table(SolutionTable *table, Grid grid, Path *path) {
+  while (table->distance[grid] > 0) {
+    solve_stats.nodes++;
+    int move = table->next_move[grid];
+    Path *longer_path = add_move_to_path(path, move);
+    drop_reference_to_path(path);
+    if (longer_path == NULL) {
+      return NULL;
+    }
+    path = longer_path;
+    grid = explode(grid, move);
+  }
+  return path;
 }
 
-/** PLAYING THE ENTIRE GAME ***************************************************/
+/**
+ * Same as `shortest_winning_path` but it first tries to answer using what the
+ * table already knows, and records what it learns in the table.
+ *
+ * If the initial grid is not in the table we still run a bfs, but we can stop
+ * as soon as we're sure that no unexplored grid could do any better than one
+ * of the grids we found in the table. A grid that's not in the table is more
+ * than `complete_layers` moves away from winning, so there's no point in
+ * going past it unless that still beats the best path found so far. Just like
+ * `shortest_winning_path`, commuting moves are only tried in one order.
+ */
+static Path *shortest_winning_path_with_table(SolutionTable *table,
+                                              Grid initial) {
+  reset_solve_stats();
+  if (table->knowledge[initial] == Solvable) {
+    return follow_table(table, initial, new_path());
+  } else if (table->knowledge[initial] == Unsolvable) {
+    return NULL;
+  }
 
-typedef enum Mode { Chatty, Silent } Mode;
+  char *visited = (char *)star_calloc(512, sizeof(bool));
+  Queue *to_visit = new_queue();
+  if (visited == NULL || to_visit == NULL) {
+    free(visited);
+    free(to_visit);
+    return NULL;
+  }
 
-void play(Grid grid, Mode mode) {
-  Path *winning_path = shortest_winning_path(grid);
+  uint16_t forbidden_after[10];
+  uint16_t forbidden[512];
+  find_commuting_moves(forbidden_after);
+  memset(forbidden, 0xFF, sizeof(forbidden));
+  forbidden[initial] = 0;
 
-  if (mode == Chatty) {
-    if (winning_path == NULL) {
-      printf("There's no winning sequence of moves!\n");
+  push_front(to_visit, new_path(), initial);
+  QueueNode *node = NULL;
+  // The best grid we found in the table so far and the path leading to it.
+  Path *best_path = NULL;
+  Grid best_grid = empty_grid;
+  int best_length = -1;
+  uint32_t queued = 1;
+  record_frontier(queued);
+
+  while ((node = pop_back(to_visit)) != NULL) {
+    solve_stats.nodes++;
+    queued--;
+    // Every move we make from here on is going to take at least this many
+    // moves, if we already know a path that's as short we can stop looking.
+    int length = path_length(node->path);
+    if (best_length >= 0 && length >= best_length) {
+      free_queue_node(node);
+      break;
+    }
+
+    visited[node->grid] = true;
+    Knowledge knowledge = table->knowledge[node->grid];
+    if (knowledge == Solvable) {
+      int total_length = length + table->distance[node->grid];
+      if (best_length < 0 || total_length < best_length) {
+        drop_reference_to_path(best_path);
+        best_path = node->path;
+        inc_reference_to_path(best_path);
+        best_grid = node->grid;
+        best_length = total_length;
+      }
+    } else if (knowledge == Unknown &&
+               (best_length < 0 ||
+                length + table->complete_layers + 1 < best_length)) {
+      for (int i = 1; i <= 9; i++) {
+        if (is_star(node->grid, i) &&
+            !(forbidden[node->grid] & (1 << (i - 1)))) {
+          Grid new_grid = explode(node->grid, i);
+          if (!visited[new_grid]) {
+            Path *new_path = add_move_to_path(node->path, i);
+            push_front(to_visit, new_path, new_grid);
+            forbidden[new_grid] &= forbidden_after[i];
+            record_frontier(++queued);
+          }
+        }
+      }
+    }
+
+    free_queue_node(node);
+  }
+
+  Path *winning_path = NULL;
+  if (best_length >= 0) {
+    winning_path = follow_table(table, best_grid, best_path);
+    learn_from_path(table, initial, winning_path);
+  } else {
+    // We went through all the grids reachable from the initial one without
+    // finding a way to win. That means there's no way to win from any of them!
+    for (int grid = 0; grid < 512; grid++) {
+      if (visited[grid]) {
+        table->knowledge[grid] = Unsolvable;
+      }
+    }
+  }
+
+  free_queue(to_visit);
+  free(visited);
+  return winning_path;
+}
+
+/**
+ * Adds at most `layers` new bfs layers to the table, going backwards from the
+ * winning grid. This is meant to be called when there's nothing better to do,
+ * so that the following queries will find more grids already in the table.
+ *
+ * If all grids `n` moves away from the winning grid are known, a grid is
+ * `n + 1` moves away if it's not in the table yet and one of its moves leads
+ * to one of those grids.
+ */
+static void extend_solution_table(SolutionTable *table, int layers) {
+  for (int layer = 0; layer < layers && !table->complete; layer++) {
+    int distance = table->complete_layers + 1;
+    bool found_new_layer = false;
+
+    for (int grid = 0; grid < 512; grid++) {
+      if (table->knowledge[grid] == Solvable) {
+        found_new_layer |= table->distance[grid] == distance;
+        continue;
+      } else if (table->knowledge[grid] == Unsolvable) {
+        continue;
+      }
+
+      for (int i = 1; i <= 9; i++) {
+        Grid new_grid = explode(grid, i);
+        if (is_star(grid, i) && table->knowledge[new_grid] == Solvable &&
+            table->distance[new_grid] == distance - 1) {
+          table->knowledge[grid] = Solvable;
+          table->next_move[grid] = i;
+          table->distance[grid] = distance;
+          found_new_layer = true;
+          break;
+        }
+      }
+    }
+
+    if (found_new_layer) {
+      table->complete_layers = distance;
     } else {
-      print_path(winning_path);
+      // If no grid is this far away, then no grid can be any farther either:
+      // everything that's still unknown can never be won.
+      for (int grid = 0; grid < 512; grid++) {
+        if (table->knowledge[grid] == Unknown) {
+          table->knowledge[grid] = Unsolvable;
+        }
+      }
+      table->complete = true;
     }
   }
+}
 
-  drop_reference_to_path(winning_path);
+/**
+ * Numbers in files are written one byte at a time, lowest first, so that files
+ * look the same no matter the endianness of the machine that wrote them.
+ */
+static void put_little_endian(unsigned char *bytes, uint64_t value,
+                              int size) {
+  for (int byte = 0; byte < size; byte++) {
+    bytes[byte] = value >> (8 * byte);
+  }
 }
 
-int main() {
-  // We play all possible games in silent mode to check if we can ever leak any
-  // memory.
-  // for (int grid = empty_grid; grid < 512; grid++) {
-  //  play(grid, Silent);
-  //}
+static uint64_t get_little_endian(unsigned char *bytes, int size) {
+  uint64_t value = 0;
+  for (int byte = size - 1; byte >= 0; byte--) {
+    value = (value << 8) | bytes[byte];
+  }
+  return value;
+}
 
-  play(0b100000000, Chatty);
+/**
+ * Writes the table in `bytes`: the complete layers as a u32, a byte for
+ * `complete` and then three bytes for each grid, its knowledge, next move and
+ * distance.
+ */
+static void encode_solution_table(SolutionTable *table,
+                                  unsigned char bytes[SOLUTION_TABLE_BYTES]) {
+  put_little_endian(bytes, table->complete_layers, 4);
+  bytes[4] = table->complete;
+  for (int grid = 0; grid < 512; grid++) {
+    bytes[5 + grid * 3] = table->knowledge[grid];
+    bytes[5 + grid * 3 + 1] = table->next_move[grid];
+    bytes[5 + grid * 3 + 2] = table->distance[grid];
+  }
+}
+
+/**
+ * Checks that following the table can't go wrong: every solvable grid must
+ * have a star to explode that leads to a solvable grid exactly one move
+ * closer to victory, so that `follow_table` always gets there. Nothing known
+ * can contradict what's known about the grids it leads to, and the complete
+ * layers must really be complete.
+ */
+static bool valid_solution_table(SolutionTable *table) {
+  if (table->knowledge[winning_grid] != Solvable ||
+      table->distance[winning_grid] != 0 ||
+      table->knowledge[empty_grid] != Unsolvable ||
+      table->complete_layers < 0 || table->complete_layers > 511) {
+    return false;
+  }
+
+  for (int grid = 0; grid < 512; grid++) {
+    Knowledge knowledge = table->knowledge[grid];
+    if (knowledge != Unknown && knowledge != Solvable &&
+        knowledge != Unsolvable) {
+      return false;
+    } else if (table->complete && knowledge == Unknown) {
+      return false;
+    } else if (knowledge == Solvable && grid != winning_grid) {
+      int move = table->next_move[grid];
+      if (move < 1 || move > 9 || !is_star(grid, move) ||
+          table->distance[grid] == 0 ||
+          table->knowledge[explode(grid, move)] != Solvable ||
+          table->distance[explode(grid, move)] != table->distance[grid] - 1) {
+        return false;
+      }
+    }
+
+    for (int i = 1; i <= 9 && grid != winning_grid; i++) {
+      Grid new_grid = explode(grid, i);
+      if (!is_star(grid, i) || table->knowledge[new_grid] != Solvable) {
+        continue;
+      }
+      int distance = table->distance[new_grid] + 1;
+      if (knowledge == Unsolvable ||
+          (knowledge == Solvable && table->distance[grid] > distance) ||
+          (knowledge == Unknown && distance <= table->complete_layers)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * The opposite of `encode_solution_table`, returns `false` leaving the table
+ * untouched if the bytes don't hold a valid table.
+ */
+static bool decode_solution_table(unsigned char bytes[SOLUTION_TABLE_BYTES],
+                                  SolutionTable *table) {
+  SolutionTable *decoded = (SolutionTable *)star_malloc(sizeof(SolutionTable));
+  if (decoded == NULL || bytes[4] > 1) {
+    free(decoded);
+    return false;
+  }
+
+  uint64_t complete_layers = get_little_endian(bytes, 4);
+  decoded->complete_layers = complete_layers > 511 ? -1 : (int)complete_layers;
+  decoded->complete = bytes[4];
+  for (int grid = 0; grid < 512; grid++) {
+    decoded->knowledge[grid] = bytes[5 + grid * 3];
+    decoded->next_move[grid] = bytes[5 + grid * 3 + 1];
+    decoded->distance[grid] = bytes[5 + grid * 3 + 2];
+  }
+
+  bool valid = valid_solution_table(decoded);
+  if (valid) {
+    memcpy(table, decoded, sizeof(SolutionTable));
+  }
+  free(decoded);
+  return valid;
+}
+
+/**
+ * Writes the table to the given file, returns `false` if anything goes wrong.
+ */
+static bool save_solution_table(SolutionTable *table, const char *file) {
+  FILE *out = fopen(file, "wb");
+  if (out == NULL) {
+    return false;
+  }
+
+  unsigned char bytes[SOLUTION_TABLE_BYTES];
+  encode_solution_table(table, bytes);
+  bool written =
+      fwrite(solution_table_magic, sizeof(solution_table_magic), 1, out) == 1 &&
+      fwrite(bytes, sizeof(bytes), 1, out) == 1;
+  return fclose(out) == 0 && written;
+}
+
+/**
+ * Loads a table previously written with `save_solution_table`.
+ * If the file doesn't exist or doesn't contain a valid table, this returns a
+ * brand new table instead, that will be rebuilt as it's used.
+ */
+static SolutionTable *load_solution_table(const char *file) {
+  SolutionTable *table = new_solution_table();
+  FILE *in = fopen(file, "rb");
+  if (table == NULL || in == NULL) {
+    if (in != NULL) {
+      fclose(in);
+    }
+    return table;
+  }
+
+  char magic[sizeof(solution_table_magic)];
+  unsigned char bytes[SOLUTION_TABLE_BYTES];
+  if (fread(magic, sizeof(magic), 1, in) == 1 &&
+      memcmp(magic, solution_table_magic, sizeof(magic)) == 0 &&
+      fread(bytes, sizeof(bytes), 1, in) == 1) {
+    decode_solution_table(bytes, table);
+  }
+
+  fclose(in);
+  return table;
+}
+
+/** CONSTRUCTIVE SOLVER *******************************************************
+ * Exploding a star toggles a fixed set of cells, so if we forget about the
+ * rule that only stars can explode, the order of the moves doesn't matter and
+ * making the same move twice is the same as not making it at all. Grids and
+ * moves are then just vectors of bits and the grid we get is the initial one
+ * xor-ed with the masks of all the moves we made.
+ *
+ * The 9 masks are all independent, so for each grid there's exactly one set of
+ * moves turning it into the winning grid. The constructive solver looks that
+ * set up in a table and sweeps the board row by row exploding the cells of the
+ * set that are stars, until none of the remaining ones can be exploded.
+ *
+ * When the sweep gets stuck it takes a detour: it explodes some other star,
+ * which adds that move to the set since it will have to be undone, and sweeps
+ * again. Detours are picked round robin, each one starting from the cell
+ * after the previous one, so that the sweep doesn't keep going back and forth
+ * between the same two grids.
+ *
+ * Each move takes a pass over the cells and nothing is ever undone, so this
+ * never searches and needs no table of solutions. The price is in the length
+ * of the paths: they're valid, but detours make them several times longer than
+ * the shortest ones. It gives up after `MAX_CONSTRUCTED_MOVES` moves.
+ */
+
+#define MAX_CONSTRUCTED_MOVES 511
+
+typedef struct ConstructiveSolver {
+  // The cells toggled by each move, index 0 is unused.
+  Grid move_masks[10];
+  // For each set of cells that needs to be toggled, the set of moves that
+  // toggle exactly those cells: move `i` is the bit `i - 1`.
+  uint16_t moves_for_toggle[512];
+} ConstructiveSolver;
+
+static ConstructiveSolver *new_constructive_solver() {
+  ConstructiveSolver *solver =
+      (ConstructiveSolver *)star_malloc(sizeof(ConstructiveSolver));
+  if (solver == NULL) {
+    return NULL;
+  }
+
+  solver->move_masks[0] = empty_grid;
+  for (int i = 1; i <= 9; i++) {
+    solver->move_masks[i] = move_mask(i);
+  }
+
+  for (int moves = 0; moves < 512; moves++) {
+    Grid toggled = empty_grid;
+    for (int i = 1; i <= 9; i++) {
+      if (moves & (1 << (i - 1))) {
+        toggled ^= solver->move_masks[i];
+      }
+    }
+    solver->moves_for_toggle[toggled] = moves;
+  }
+  return solver;
+}
+
+static void free_constructive_solver(ConstructiveSolver *solver) {
+  free(solver);
+}
+
+/**
+ * Picks the star to explode for a detour, trying the cells round robin from
+ * `*next_detour` onwards. Returns 0 if every star would lose the game.
+ */
+static int pick_detour(Grid grid, int *next_detour) {
+  for (int k = 0; k < 9; k++) {
+    int cell = (*next_detour + k) % 9 + 1;
+    if (is_star(grid, cell) && explode(grid, cell) != empty_grid) {
+      *next_detour = (*next_detour + 1) % 9;
+      return cell;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Adds a move to the path and makes it on the grid, toggling it in the set of
+ * pending moves. Returns `false` if there's not enough memory, in which case
+ * the path is gone.
+ */
+static bool make_constructed_move(Path **path, Grid *grid, uint16_t *pending,
+                                  int move) {
+  Path *longer_path = add_move_to_path(*path, move);
+  drop_reference_to_path(*path);
+  *path = longer_path;
+  *grid = explode(*grid, move);
+  *pending ^= 1 << (move - 1);
+  solve_stats.nodes++;
+  return longer_path != NULL;
+}
+
+/**
+ * Returns a winning path from the given grid, or `NULL` if it can't find one.
+ * Just like the one returned by `shortest_winning_path` the path is in reverse
+ * order.
+ */
+static Path *constructive_winning_path(ConstructiveSolver *solver,
+                                       Grid grid) {
+  uint16_t pending = solver->moves_for_toggle[grid ^ winning_grid];
+  Path *path = new_path();
+  int made = 0;
+  int next_detour = 0;
+  reset_solve_stats();
+
+  while (outcome(grid) == Continue && made < MAX_CONSTRUCTED_MOVES) {
+    bool progress = false;
+    for (int i = 1; i <= 9 && made < MAX_CONSTRUCTED_MOVES; i++) {
+      // Exploding a star that would lose the game is left for later on in
+      // the sweep, maybe it'll be safe by then.
+      if (!(pending & (1 << (i - 1))) || !is_star(grid, i) ||
+          explode(grid, i) == empty_grid) {
+        continue;
+      } else if (!make_constructed_move(&path, &grid, &pending, i)) {
+        return NULL;
+      }
+      made++;
+      progress = true;
+    }
+
+    if (progress || outcome(grid) != Continue ||
+        made == MAX_CONSTRUCTED_MOVES) {
+      continue;
+    }
+    int detour = pick_detour(grid, &next_detour);
+    if (detour == 0) {
+      break;
+    } else if (!make_constructed_move(&path, &grid, &pending, detour)) {
+      return NULL;
+    }
+    made++;
+  }
+
+  if (grid != winning_grid) {
+    drop_reference_to_path(path);
+    return NULL;
+  }
+  return path;
+}
+
+/** SOLUTION POST-OPTIMIZER ***************************************************
+ * Solvers that don't search, like the constructive one, find valid paths that
+ * are often longer than needed. Forgetting about stars for a moment, making a
+ * move twice is the same as not making it at all, and if some set of moves
+ * toggles no cell at all (that is, it's in the null space of the matrix made
+ * of the move masks) it can be swapped with the moves it's missing.
+ *
+ * So, given a valid path, the post-optimizer looks for the smallest multiset of
+ * moves that has the same effect and can still be ordered so that each move
+ * explodes a star: it tries dropping pairs of equal moves first and then
+ * replacing moves using the null space, shortest candidates first. On the 3x3
+ * board the masks are independent and the null space is empty, so the only
+ * candidates are the moves made an odd number of times plus pairs.
+ *
+ * Finding an ordering is an exact search over the orders of a multiset, so
+ * the whole optimization is bounded by `MAX_ORDERING_STEPS`: when it runs out
+ * the original path is kept.
+ */
+
+#define MAX_ORDERING_STEPS 100000
+
+typedef struct Ordering {
+  int remaining[10];
+  int strides[10];
+  int length;
+  int *moves;
+  // All the combinations of remaining moves we already know can't be ordered,
+  // indexed by `remaining` written in mixed radix using `strides`. The buffer
+  // is shared by all the candidates and only grows.
+  bool *dead_ends;
+  int dead_ends_capacity;
+  // How many more calls to `find_ordering` we're willing to make.
+  long steps_left;
+} Ordering;
+
+/**
+ * Computes a basis of the sets of moves whose masks xor-ed together give the
+ * empty grid, each set is a bitmap where move `i` is the bit `i - 1`.
+ * Returns the dimension of the null space.
+ */
+static int null_space_basis(Grid move_masks[10], uint16_t basis[9]) {
+  // Each pivot is a combination of masks with a distinct leading bit, together
+  // with the moves it's made of.
+  Grid pivot_masks[16] = {0};
+  uint16_t pivot_moves[16] = {0};
+  int dimension = 0;
+
+  for (int i = 1; i <= 9; i++) {
+    Grid mask = move_masks[i];
+    uint16_t moves = 1 << (i - 1);
+    for (int bit = 15; bit >= 0 && mask != empty_grid; bit--) {
+      if (!(mask & (1 << bit))) {
+        continue;
+      } else if (pivot_masks[bit] == empty_grid) {
+        pivot_masks[bit] = mask;
+        pivot_moves[bit] = moves;
+        break;
+      }
+      mask ^= pivot_masks[bit];
+      moves ^= pivot_moves[bit];
+    }
+    if (mask == empty_grid) {
+      basis[dimension++] = moves;
+    }
+  }
+  return dimension;
+}
+
+/**
+ * Tries to order all the remaining moves so that every move explodes a star
+ * and the game only ends with the last move, in which case it must be won.
+ * `key` is the current index of `remaining` in the `dead_ends` table.
+ */
+static bool find_ordering(Ordering *ordering, Grid grid, int key, int made) {
+  if (made == ordering->length) {
+    return grid == winning_grid;
+  } else if (outcome(grid) != Continue || ordering->dead_ends[key] ||
+             ordering->steps_left <= 0) {
+    return false;
+  }
+  ordering->steps_left--;
+
+  for (int i = 1; i <= 9; i++) {
+    if (ordering->remaining[i] > 0 && is_star(grid, i)) {
+      ordering->remaining[i]--;
+      ordering->moves[made] = i;
+      bool found = find_ordering(ordering, explode(grid, i),
+                                 key - ordering->strides[i], made + 1);
+      ordering->remaining[i]++;
+      if (found) {
+        return true;
+      }
+    }
+  }
+
+  // Running out of steps doesn't prove anything.
+  ordering->dead_ends[key] = ordering->steps_left > 0;
+  return false;
+}
+
+/**
+ * Tries to order the moves with the given counts, returns `true` if it
+ * succeeds and the ordered moves are stored in `ordering->moves`.
+ */
+static bool order_counts(Ordering *ordering, Grid initial, int counts[10]) {
+  int combinations = 1;
+  ordering->length = 0;
+  for (int i = 1; i <= 9; i++) {
+    ordering->remaining[i] = counts[i];
+    ordering->strides[i] = combinations;
+    ordering->length += counts[i];
+    combinations *= counts[i] + 1;
+  }
+
+  if (combinations > ordering->dead_ends_capacity) {
+    bool *grown = (bool *)star_realloc(ordering->dead_ends,
+                                       combinations * sizeof(bool));
+    if (grown == NULL) {
+      return false;
+    }
+    ordering->dead_ends = grown;
+    ordering->dead_ends_capacity = combinations;
+  }
+  memset(ordering->dead_ends, 0, combinations * sizeof(bool));
+  return find_ordering(ordering, initial, combinations - 1, 0);
+}
+
+/**
+ * Goes through all the ways of adding `pairs` pairs of equal moves to the
+ * `counts`, from cell `cell` onwards, without making any move more than
+ * `limits` times. Stops at the first one that can be ordered.
+ */
+static bool order_with_pairs(Ordering *ordering, Grid initial, int counts[10],
+                             int limits[10], int cell, int pairs) {
+  if (pairs == 0) {
+    return order_counts(ordering, initial, counts);
+  } else if (cell > 9 || ordering->steps_left <= 0) {
+    return false;
+  }
+
+  for (int added = 0; added <= pairs; added++) {
+    if (counts[cell] + 2 * added > limits[cell]) {
+      break;
+    }
+    counts[cell] += 2 * added;
+    bool found = order_with_pairs(ordering, initial, counts, limits, cell + 1,
+                                  pairs - added);
+    counts[cell] -= 2 * added;
+    if (found) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Returns a path that's at most as long as the given valid path starting from
+ * `initial` and reaches the winning grid as well.
+ * The result is a new reference, the caller still has to drop its reference
+ * to `path`.
+ */
+static Path *optimize_path(Grid initial, Path *path) {
+  int length = path_length(path);
+  int *moves = (int *)star_malloc(sizeof(int) * (length + 1));
+  if (moves == NULL) {
+    inc_reference_to_path(path);
+    return path;
+  }
+
+  // How many times each move is made in the original path, and which moves are
+  // made an odd number of times.
+  int original_counts[10] = {0};
+  uint16_t odd_moves = 0;
+  for (Path *rest = path; rest != NULL; rest = rest->rest) {
+    original_counts[rest->move]++;
+    odd_moves ^= 1 << (rest->move - 1);
+  }
+
+  Grid move_masks[10] = {empty_grid};
+  for (int i = 1; i <= 9; i++) {
+    move_masks[i] = move_mask(i);
+  }
+  uint16_t basis[9];
+  int dimension = null_space_basis(move_masks, basis);
+
+  // Each candidate starts from a set of moves with the same effect as the
+  // original path, so no path is shorter than the smallest of those.
+  uint16_t candidates[1 << 9];
+  int shortest = length;
+  for (int combination = 0; combination < (1 << dimension); combination++) {
+    candidates[combination] = odd_moves;
+    for (int b = 0; b < dimension; b++) {
+      if (combination & (1 << b)) {
+        candidates[combination] ^= basis[b];
+      }
+    }
+    int size = __builtin_popcount(candidates[combination]);
+    shortest = size < shortest ? size : shortest;
+  }
+
+  Ordering ordering = {.moves = moves, .steps_left = MAX_ORDERING_STEPS};
+  bool found = false;
+  // Candidates are tried shortest first. Pairs of equal moves are added back
+  // to the starting set: a move can be made as often as in the original path,
+  // or up to twice more than in the starting set.
+  for (int target = shortest; target < length && !found &&
+                              ordering.steps_left > 0;
+       target++) {
+    for (int combination = 0; combination < (1 << dimension) && !found;
+         combination++) {
+      uint16_t candidate = candidates[combination];
+
+      int counts[10] = {0};
+      int limits[10] = {0};
+      int size = 0;
+      for (int i = 1; i <= 9; i++) {
+        counts[i] = (candidate >> (i - 1)) & 1;
+        limits[i] = counts[i] + 2;
+        if (original_counts[i] > limits[i]) {
+          limits[i] = original_counts[i];
+        }
+        size += counts[i];
+      }
+
+      if (size <= target && (target - size) % 2 == 0) {
+        found = order_with_pairs(&ordering, initial, counts, limits, 1,
+                                 (target - size) / 2);
+      }
+    }
+  }
+
+  Path *optimized = path;
+  inc_reference_to_path(optimized);
+  if (found) {
+    drop_reference_to_path(optimized);
+    optimized = new_path();
+    for (int i = 0; i < ordering.length; i++) {
+      Path *longer_path = add_move_to_path(optimized, moves[i]);
+      drop_reference_to_path(optimized);
+      if (longer_path == NULL) {
+        // We couldn't build the optimized path, the original one will do.
+        optimized = path;
+        inc_reference_to_path(optimized);
+        break;
+      }
+      optimized = longer_path;
+    }
+  }
+
+  free(ordering.dead_ends);
+  free(moves);
+  return optimized;
+}
+
+/** THE MOVE GRAPH ************************************************************
+ * Grids and moves form a directed graph: there's an edge from a grid to each
+ * of the grids we get by exploding one of its stars, labelled with the cell
+ * that was exploded.
+ *
+ * We store it in compressed sparse row form: the edges leaving grid `g` are
+ * found in `forward_targets` (and `forward_moves`) starting at
+ * `forward_offsets[g]` and up to `forward_offsets[g + 1]` excluded.
+ * The same goes for the edges entering a grid, in the `reverse_*` arrays.
+ *
+ * A grid can have at most 9 stars so 9 edges per grid is plenty of space.
+ */
+
+typedef struct MoveGraph {
+  int edges;
+  uint16_t forward_offsets[513];
+  uint16_t forward_targets[512 * 9];
+  uint8_t forward_moves[512 * 9];
+  uint16_t reverse_offsets[513];
+  uint16_t reverse_sources[512 * 9];
+  uint8_t reverse_moves[512 * 9];
+} MoveGraph;
+
+static const char move_graph_magic[8] = {'S', 'T', 'A', 'R', 'C', 'S', 'R', '1'};
+
+/**
+ * Builds the entire move graph. Exploding a cell that's not a star is not a
+ * move, so those never show up as edges.
+ */
+static MoveGraph *new_move_graph() {
+  MoveGraph *graph = (MoveGraph *)star_calloc(1, sizeof(MoveGraph));
+  if (graph == NULL) {
+    return NULL;
+  }
+
+  // The forward edges come out already sorted by source grid, while doing
+  // that we count how many edges enter each grid.
+  int edges = 0;
+  uint16_t in_degree[512] = {0};
+  for (int grid = 0; grid < 512; grid++) {
+    graph->forward_offsets[grid] = edges;
+    for (int i = 1; i <= 9; i++) {
+      if (is_star(grid, i)) {
+        Grid new_grid = explode(grid, i);
+        graph->forward_targets[edges] = new_grid;
+        graph->forward_moves[edges] = i;
+        in_degree[new_grid]++;
+        edges++;
+      }
+    }
+  }
+  graph->forward_offsets[512] = edges;
+  graph->edges = edges;
+
+  // Knowing the in degree of each grid tells us where its reverse edges start,
+  // then we can just drop each edge in the first free slot of its target.
+  uint16_t next_free[512];
+  int offset = 0;
+  for (int grid = 0; grid < 512; grid++) {
+    graph->reverse_offsets[grid] = offset;
+    next_free[grid] = offset;
+    offset += in_degree[grid];
+  }
+  graph->reverse_offsets[512] = offset;
+
+  for (int grid = 0; grid < 512; grid++) {
+    for (int e = graph->forward_offsets[grid];
+         e < graph->forward_offsets[grid + 1]; e++) {
+      int slot = next_free[graph->forward_targets[e]]++;
+      graph->reverse_sources[slot] = grid;
+      graph->reverse_moves[slot] = graph->forward_moves[e];
+    }
+  }
+
+  return graph;
+}
+
+/**
+ * Writes the graph to a file so that it can be analysed by other tools.
+ * The format is as follows, all numbers are little endian:
+ *
+ *     "STARCSR1"                    magic
+ *     u32 nodes, u32 edges
+ *     u32 forward_offsets[nodes + 1]
+ *     u16 forward_targets[edges],   u8 forward_moves[edges]
+ *     u32 reverse_offsets[nodes + 1]
+ *     u16 reverse_sources[edges],   u8 reverse_moves[edges]
+ *
+ * Returns `false` if anything goes wrong.
+ */
+static bool write_move_graph(MoveGraph *graph, const char *file) {
+  FILE *out = fopen(file, "wb");
+  if (out == NULL) {
+    return false;
+  }
+
+  unsigned char buffer[512 * 9 * 2];
+  bool written =
+      fwrite(move_graph_magic, sizeof(move_graph_magic), 1, out) == 1;
+
+  // Numbers are written one byte at a time so the file looks the same no
+  // matter the endianness of the machine that wrote it.
+  uint32_t header[2] = {512, graph->edges};
+  for (int i = 0; i < 2; i++) {
+    for (int byte = 0; byte < 4; byte++) {
+      buffer[i * 4 + byte] = header[i] >> (8 * byte);
+    }
+  }
+  written = written && fwrite(buffer, 1, 8, out) == 8;
+
+  for (int direction = 0; direction < 2; direction++) {
+    uint16_t *offsets =
+        direction == 0 ? graph->forward_offsets : graph->reverse_offsets;
+    uint16_t *grids =
+        direction == 0 ? graph->forward_targets : graph->reverse_sources;
+    uint8_t *moves =
+        direction == 0 ? graph->forward_moves : graph->reverse_moves;
+
+    for (int i = 0; i <= 512; i++) {
+      for (int byte = 0; byte < 4; byte++) {
+        buffer[i * 4 + byte] = byte < 2 ? offsets[i] >> (8 * byte) : 0;
+      }
+    }
+    written = written && fwrite(buffer, 4, 513, out) == 513;
+
+    for (int e = 0; e < graph->edges; e++) {
+      buffer[e * 2] = grids[e] & 0xFF;
+      buffer[e * 2 + 1] = grids[e] >> 8;
+    }
+    written = written && fwrite(buffer, 2, graph->edges, out) ==
+                             (size_t)graph->edges;
+    written = written && fwrite(moves, 1, graph->edges, out) ==
+                             (size_t)graph->edges;
+  }
+
+  return fclose(out) == 0 && written;
+}
+
+/** STRONGLY CONNECTED COMPONENTS *********************************************
+ * Moves can't always be undone: exploding a star turns it into a dark hole, and
+ * that hole has to be lit again before we can go back. So the move graph is
+ * split into strongly connected components: groups of grids that can all be
+ * reached from one another. A component with no way out is a trap, once we get
+ * there we can never leave it.
+ *
+ * Components are found with the forward-backward algorithm: pick a grid in a
+ * set, the grids that can both reach it and be reached from it are its
+ * component. All the others are split in three sets (only reachable, only
+ * reaching, neither) that can't share any component and are dealt with on
+ * their own. Before that, grids without any incoming or outgoing edge are
+ * trimmed away since they're always a component by themselves.
+ */
+
+typedef struct Component {
+  int size;
+  // Number of edges between two grids of the component.
+  int internal_edges;
+  // Number of edges going into and out of the component.
+  int incoming_edges;
+  int outgoing_edges;
+  bool has_winning_grid;
+  // `true` if the winning grid can be reached from the grids of the component.
+  bool can_win;
+} Component;
+
+typedef struct Components {
+  int count;
+  // The component each grid belongs to.
+  int of[512];
+  Component stats[512];
+} Components;
+
+/**
+ * Marks as `reached` all the grids in the set `set` that can be reached from
+ * `start` following only edges inside that set. Following the reverse edges
+ * instead gives all the grids that can reach `start`.
+ */
+static void reach_in_set(MoveGraph *graph, bool reverse, int *set_of,
+                         int set, Grid start, bool *reached) {
+  uint16_t *offsets = reverse ? graph->reverse_offsets : graph->forward_offsets;
+  uint16_t *grids = reverse ? graph->reverse_sources : graph->forward_targets;
+  uint16_t stack[512];
+  int top = 0;
+
+  reached[start] = true;
+  stack[top++] = start;
+  while (top > 0) {
+    Grid grid = stack[--top];
+    for (int e = offsets[grid]; e < offsets[grid + 1]; e++) {
+      Grid other = grids[e];
+      if (set_of[other] == set && !reached[other]) {
+        reached[other] = true;
+        stack[top++] = other;
+      }
+    }
+  }
+}
+
+/**
+ * Assigns to its own component every grid that has no edges coming in or no
+ * edges going out within its set, until there's none left.
+ */
+static void trim(MoveGraph *graph, int *set_of, Components *components) {
+  bool trimmed = true;
+  while (trimmed) {
+    trimmed = false;
+    for (int grid = 0; grid < 512; grid++) {
+      int set = set_of[grid];
+      if (set < 0) {
+        continue;
+      }
+
+      bool has_in = false;
+      bool has_out = false;
+      for (int e = graph->reverse_offsets[grid];
+           e < graph->reverse_offsets[grid + 1] && !has_in; e++) {
+        Grid other = graph->reverse_sources[e];
+        has_in = other != grid && set_of[other] == set;
+      }
+      for (int e = graph->forward_offsets[grid];
+           e < graph->forward_offsets[grid + 1] && !has_out; e++) {
+        Grid other = graph->forward_targets[e];
+        has_out = other != grid && set_of[other] == set;
+      }
+
+      if (!has_in || !has_out) {
+        components->of[grid] = components->count++;
+        set_of[grid] = -1;
+        trimmed = true;
+      }
+    }
+  }
+}
+
+/**
+ * Splits the graph in its strongly connected components and computes some
+ * statistics about each of them.
+ */
+static Components *find_components(MoveGraph *graph) {
+  Components *components = (Components *)star_calloc(1, sizeof(Components));
+  if (components == NULL) {
+    return NULL;
+  }
+
+  // Each grid that hasn't been assigned a component yet belongs to a set,
+  // `-1` means it's already been assigned. We start with a single set.
+  int set_of[512] = {0};
+  int pending_sets[512];
+  int pending = 0;
+  int sets = 1;
+  pending_sets[pending++] = 0;
+  trim(graph, set_of, components);
+
+  while (pending > 0) {
+    int set = pending_sets[--pending];
+    int pivot = 0;
+    while (pivot < 512 && set_of[pivot] != set) {
+      pivot++;
+    }
+    if (pivot == 512) {
+      // The whole set was trimmed away.
+      continue;
+    }
+
+    bool forward[512] = {false};
+    bool backward[512] = {false};
+    reach_in_set(graph, false, set_of, set, pivot, forward);
+    reach_in_set(graph, true, set_of, set, pivot, backward);
+
+    // The three leftover sets get brand new ids.
+    int component = components->count++;
+    int only_forward = sets++;
+    int only_backward = sets++;
+    int neither = sets++;
+    bool used[3] = {false};
+    for (int grid = 0; grid < 512; grid++) {
+      if (set_of[grid] != set) {
+        continue;
+      } else if (forward[grid] && backward[grid]) {
+        components->of[grid] = component;
+        set_of[grid] = -1;
+      } else if (forward[grid]) {
+        set_of[grid] = only_forward;
+        used[0] = true;
+      } else if (backward[grid]) {
+        set_of[grid] = only_backward;
+        used[1] = true;
+      } else {
+        set_of[grid] = neither;
+        used[2] = true;
+      }
+    }
+
+    for (int i = 0; i < 3; i++) {
+      if (used[i]) {
+        pending_sets[pending++] = only_forward + i;
+      }
+    }
+    trim(graph, set_of, components);
+  }
+
+  // To know which grids can win we go backwards from the winning grid.
+  bool can_win[512] = {false};
+  int no_set[512] = {0};
+  reach_in_set(graph, true, no_set, 0, winning_grid, can_win);
+
+  for (int grid = 0; grid < 512; grid++) {
+    Component *stats = &components->stats[components->of[grid]];
+    stats->size++;
+    stats->has_winning_grid |= grid == winning_grid;
+    stats->can_win |= can_win[grid];
+    for (int e = graph->forward_offsets[grid];
+         e < graph->forward_offsets[grid + 1]; e++) {
+      int other = components->of[graph->forward_targets[e]];
+      if (other == components->of[grid]) {
+        stats->internal_edges++;
+      } else {
+        stats->outgoing_edges++;
+        components->stats[other].incoming_edges++;
+      }
+    }
+  }
+
+  return components;
+}
+
+/** DENSE TABLES OVER REACHABLE GRIDS *****************************************
+ * Tables indexed directly by a grid need a slot for every possible grid, even
+ * if only a few of them can ever show up starting from the grids we care
+ * about. Instead, we can find all the reachable grids once and give each of
+ * them a distinct index from 0 up to the number of reachable grids: this is a
+ * minimal perfect hash, and tables indexed by it have no wasted slots.
+ *
+ * The index is a bitmap with a bit for each reachable grid. The index of a grid
+ * is the number of reachable grids that come before it: that's the number of
+ * bits set in the preceding 64 bit words (which we compute once and store in
+ * `rank_before`) plus the bits set before it in its own word.
+ */
+
+typedef struct ReachableIndex {
+  uint64_t reachable[8];
+  uint16_t rank_before[8];
+  int count;
+} ReachableIndex;
+
+// The distance we give to grids that can never be won.
+static const unsigned char dead_distance = 0xFF;
+
+typedef struct DenseTables {
+  ReachableIndex index;
+  // Both tables have a slot for each reachable grid.
+  unsigned char *distance;
+  unsigned char *next_move;
+} DenseTables;
+
+static bool is_reachable(ReachableIndex *index, Grid grid) {
+  return index->reachable[grid >> 6] & ((uint64_t)1 << (grid & 63));
+}
+
+/**
+ * Returns the dense index of a reachable grid, the result is meaningless for
+ * grids that are not reachable.
+ */
+static int grid_rank(ReachableIndex *index, Grid grid) {
+  uint64_t before = ((uint64_t)1 << (grid & 63)) - 1;
+  return index->rank_before[grid >> 6] +
+         __builtin_popcountll(index->reachable[grid >> 6] & before);
+}
+
+/**
+ * Builds the index of all the grids that can show up while playing starting
+ * from any of the given grids. Once a game is over we stop making moves, so the
+ * grids after a winning or losing one are not reachable through it.
+ */
+static void build_reachable_index(ReachableIndex *index, Grid *starts,
+                                  int count) {
+  Grid to_visit[512];
+  int visiting = 0;
+  memset(index, 0, sizeof(ReachableIndex));
+
+  for (int s = 0; s < count; s++) {
+    if (!is_reachable(index, starts[s])) {
+      index->reachable[starts[s] >> 6] |= (uint64_t)1 << (starts[s] & 63);
+      to_visit[visiting++] = starts[s];
+    }
+  }
+
+  while (visiting > 0) {
+    Grid grid = to_visit[--visiting];
+    if (outcome(grid) != Continue) {
+      continue;
+    }
+    for (int i = 1; i <= 9; i++) {
+      Grid new_grid = explode(grid, i);
+      if (is_star(grid, i) && !is_reachable(index, new_grid)) {
+        index->reachable[new_grid >> 6] |= (uint64_t)1 << (new_grid & 63);
+        to_visit[visiting++] = new_grid;
+      }
+    }
+  }
+
+  for (int word = 0; word < 8; word++) {
+    index->rank_before[word] = index->count;
+    index->count += __builtin_popcountll(index->reachable[word]);
+  }
+}
+
+/**
+ * Builds the distance and next move tables for all the grids reachable from
+ * the given ones. Grids that can't be won get a `dead_distance`.
+ *
+ * This is a bfs going backwards from the winning grid: a grid `g` can be
+ * reached from `p` by exploding `i` if `p` has a star in `i` and
+ * `p = g ^ move_mask(i)`.
+ */
+static DenseTables *new_dense_tables(Grid *starts, int count) {
+  DenseTables *tables = (DenseTables *)star_malloc(sizeof(DenseTables));
+  if (tables == NULL) {
+    return NULL;
+  }
+
+  build_reachable_index(&tables->index, starts, count);
+  tables->distance = (unsigned char *)star_malloc(tables->index.count);
+  tables->next_move = (unsigned char *)star_malloc(tables->index.count);
+  if (tables->distance == NULL || tables->next_move == NULL) {
+    free(tables->distance);
+    free(tables->next_move);
+    free(tables);
+    return NULL;
+  }
+  memset(tables->distance, dead_distance, tables->index.count);
+  memset(tables->next_move, 0, tables->index.count);
+
+  ReachableIndex *index = &tables->index;
+  if (!is_reachable(index, winning_grid)) {
+    return tables;
+  }
+
+  Grid queue[512];
+  int first = 0;
+  int last = 0;
+  queue[last++] = winning_grid;
+  tables->distance[grid_rank(index, winning_grid)] = 0;
+
+  while (first < last) {
+    Grid grid = queue[first++];
+    int distance = tables->distance[grid_rank(index, grid)];
+    for (int i = 1; i <= 9; i++) {
+      Grid previous = grid ^ move_mask(i);
+      if (!is_star(previous, i) || !is_reachable(index, previous) ||
+          outcome(previous) != Continue) {
+        continue;
+      }
+
+      int rank = grid_rank(index, previous);
+      if (tables->distance[rank] == dead_distance) {
+        tables->distance[rank] = distance + 1;
+        tables->next_move[rank] = i;
+        queue[last++] = previous;
+      }
+    }
+  }
+
+  return tables;
+}
+
+static void free_dense_tables(DenseTables *tables) {
+  if (tables != NULL) {
+    free(tables->distance);
+    free(tables->next_move);
+    free(tables);
+  }
+}
+
+/**
+ * Writes the shortest sequence of moves from `grid` to the winning grid in
+ * `moves`, the grid must be one of those the tables were built for.
+ * Returns the number of moves, or -1 if there's no way to win.
+ */
+static int dense_winning_moves(DenseTables *tables, Grid grid,
+                               int moves[511]) {
+  reset_solve_stats();
+  if (!is_reachable(&tables->index, grid)) {
+    return -1;
+  }
+
+  int rank = grid_rank(&tables->index, grid);
+  if (tables->distance[rank] == dead_distance) {
+    return -1;
+  }
+
+  int length = 0;
+  while (tables->distance[rank] > 0) {
+    solve_stats.nodes++;
+    moves[length] = tables->next_move[rank];
+    grid = explode(grid, moves[length++]);
+    rank = grid_rank(&tables->index, grid);
+  }
+  return length;
+}
+
+/** SYMMETRIES ****************************************************************
+ * Rotating or mirroring a grid doesn't change how hard it is to win: the rules
+ * are the same no matter how we look at the board, so if we transform a grid
+ * and the moves of its solution in the same way we get a solution for the
+ * transformed grid. The 8 symmetries of the square split the grids in orbits,
+ * and a table only needs one entry for each orbit.
+ *
+ * The smallest grid of each orbit is its canonical representative, and each
+ * canonical representative gets a dense index from 0 up to the number of
+ * orbits. Canonicalizing a grid means trying the 8 symmetries and finding
+ * the representative back among the sorted ones, which is too slow to do at
+ * each move: so it's done once for each of the 512 grids when building the
+ * symmetries, and `orbit_rank` is a single lookup in a 1KB table.
+ */
+
+typedef struct Symmetries {
+  // Each cell after applying one of the 8 symmetries, index 0 is unused.
+  unsigned char cells[8][10];
+  // The symmetry undoing each symmetry.
+  unsigned char inverse[8];
+  // The orbit of each grid in the low bits, and the symmetry turning the grid
+  // into its canonical representative in the top `symmetry_bits`.
+  uint16_t rank[512];
+  int orbits;
+  // The canonical representative of each orbit, in increasing order.
+  Grid unrank[];
+} Symmetries;
+
+static const int symmetry_bits = 3;
+
+/**
+ * Applies the symmetry to a cell. Symmetries are numbered as follows: the
+ * identity, the three clockwise rotations, the horizontal and vertical
+ * mirroring and the mirroring along the two diagonals.
+ */
+static int transform_cell(int symmetry, int cell) {
+  int row = (cell - 1) / 3;
+  int column = (cell - 1) % 3;
+  int new_row = row;
+  int new_column = column;
+  switch (symmetry) {
+  case 1:
+    new_row = column, new_column = 2 - row;
+    break;
+  case 2:
+    new_row = 2 - row, new_column = 2 - column;
+    break;
+  case 3:
+    new_row = 2 - column, new_column = row;
+    break;
+  case 4:
+    new_column = 2 - column;
+    break;
+  case 5:
+    new_row = 2 - row;
+    break;
+  case 6:
+    new_row = column, new_column = row;
+    break;
+  case 7:
+    new_row = 2 - column, new_column = 2 - row;
+    break;
+  }
+  return new_row * 3 + new_column + 1;
+}
+
+/** Applies the symmetry to each star of the grid. */
+static Grid transform_grid(Symmetries *symmetries, int symmetry, Grid grid) {
+  Grid transformed = empty_grid;
+  for (int cell = 1; cell <= 9; cell++) {
+    if (is_star(grid, cell)) {
+      transformed |= cell1 >> (symmetries->cells[symmetry][cell] - 1);
+    }
+  }
+  return transformed;
+}
+
+/**
+ * Returns the canonical representative of the grid, and the symmetry turning
+ * the grid into it in `symmetry`.
+ */
+static Grid canonical_grid(Symmetries *symmetries, Grid grid, int *symmetry) {
+  Grid canonical = grid;
+  *symmetry = 0;
+  for (int s = 1; s < 8; s++) {
+    Grid transformed = transform_grid(symmetries, s, grid);
+    if (transformed < canonical) {
+      canonical = transformed;
+      *symmetry = s;
+    }
+  }
+  return canonical;
+}
+
+/**
+ * Returns the index of the orbit of the grid, and the symmetry turning the
+ * grid into its canonical representative in `symmetry`.
+ */
+static int orbit_rank(Symmetries *symmetries, Grid grid, int *symmetry) {
+  uint16_t rank = symmetries->rank[grid];
+  *symmetry = rank >> (16 - symmetry_bits);
+  return rank & ((1 << (16 - symmetry_bits)) - 1);
+}
+
+/**
+ * Precomputes the cell permutations and the canonical representatives.
+ * Returns `NULL` if the rules turn out not to be symmetric, that is if
+ * exploding a transformed cell of a transformed grid is not the same as
+ * transforming the result of exploding the original cell.
+ */
+static Symmetries *new_symmetries() {
+  Symmetries cells = {0};
+  for (int s = 0; s < 8; s++) {
+    for (int cell = 1; cell <= 9; cell++) {
+      cells.cells[s][cell] = transform_cell(s, cell);
+    }
+  }
+
+  for (int s = 0; s < 8; s++) {
+    for (int other = 0; other < 8; other++) {
+      if (cells.cells[other][cells.cells[s][1]] == 1 &&
+          cells.cells[other][cells.cells[s][2]] == 2) {
+        cells.inverse[s] = other;
+      }
+    }
+  }
+
+  for (int s = 0; s < 8; s++) {
+    for (int grid = 0; grid < 512; grid++) {
+      for (int cell = 1; cell <= 9; cell++) {
+        Grid transformed = transform_grid(&cells, s, grid);
+        Grid exploded = explode(transformed, cells.cells[s][cell]);
+        if (exploded != transform_grid(&cells, s, explode(grid, cell))) {
+          return NULL;
+        }
+      }
+    }
+  }
+
+  int symmetry;
+  for (int grid = 0; grid < 512; grid++) {
+    if (canonical_grid(&cells, grid, &symmetry) == grid) {
+      cells.orbits++;
+    }
+  }
+
+  Symmetries *symmetries = (Symmetries *)star_malloc(
+      sizeof(Symmetries) + cells.orbits * sizeof(Grid));
+  if (symmetries == NULL) {
+    return NULL;
+  }
+  *symmetries = cells;
+
+  // Grids are visited in increasing order, so representatives come sorted,
+  // and each grid comes after its representative which is already ranked.
+  int orbit = 0;
+  for (int grid = 0; grid < 512; grid++) {
+    Grid canonical = canonical_grid(&cells, grid, &symmetry);
+    if (canonical == grid) {
+      symmetries->unrank[orbit] = grid;
+      symmetries->rank[grid] = orbit++;
+    }
+    symmetries->rank[grid] = (symmetries->rank[canonical] &
+                              ((1 << (16 - symmetry_bits)) - 1)) |
+                             (symmetry << (16 - symmetry_bits));
+  }
+  return symmetries;
+}
+
+/**
+ * Given a move made on the canonical representative of a grid, that the grid
+ * is turned into by `symmetry`, returns the same move made on the grid itself.
+ */
+static int move_from_canonical(Symmetries *symmetries, int symmetry,
+                               int move) {
+  int back = symmetries->inverse[symmetry];
+  return symmetries->cells[back][move];
+}
+
+/**
+ * A solution table with a single entry for each orbit, indexed by its rank.
+ * Moves are stored as they should be made on the canonical representative.
+ */
+typedef struct OrbitTable {
+  Symmetries *symmetries;
+  unsigned char *distance;
+  unsigned char *next_move;
+} OrbitTable;
+
+static void free_orbit_table(OrbitTable *table) {
+  if (table != NULL) {
+    free(table->symmetries);
+    free(table->distance);
+    free(table->next_move);
+    free(table);
+  }
+}
+
+/**
+ * Builds an orbit table out of a complete solution table.
+ */
+static OrbitTable *new_orbit_table(SolutionTable *solutions) {
+  OrbitTable *table = (OrbitTable *)star_calloc(1, sizeof(OrbitTable));
+  if (table == NULL) {
+    return NULL;
+  }
+
+  table->symmetries = new_symmetries();
+  if (table->symmetries == NULL) {
+    free_orbit_table(table);
+    return NULL;
+  }
+
+  int orbits = table->symmetries->orbits;
+  table->distance = (unsigned char *)star_malloc(orbits);
+  table->next_move = (unsigned char *)star_malloc(orbits);
+  if (table->distance == NULL || table->next_move == NULL) {
+    free_orbit_table(table);
+    return NULL;
+  }
+
+  for (int orbit = 0; orbit < orbits; orbit++) {
+    Grid canonical = table->symmetries->unrank[orbit];
+    bool solvable = solutions->knowledge[canonical] == Solvable;
+    table->distance[orbit] =
+        solvable ? solutions->distance[canonical] : dead_distance;
+    table->next_move[orbit] = solutions->next_move[canonical];
+  }
+  return table;
+}
+
+/**
+ * Same as `dense_winning_moves` but using an orbit table: at each step we look
+ * up the move for the canonical representative and turn it back into a move
+ * for the grid we actually have.
+ */
+static int orbit_winning_moves(OrbitTable *table, Grid grid, int moves[511]) {
+  Symmetries *symmetries = table->symmetries;
+  int symmetry;
+  int orbit = orbit_rank(symmetries, grid, &symmetry);
+  reset_solve_stats();
+  if (table->distance[orbit] == dead_distance) {
+    return -1;
+  }
+
+  int length = 0;
+  while (table->distance[orbit] > 0) {
+    solve_stats.nodes++;
+    int move = table->next_move[orbit];
+    moves[length] = move_from_canonical(symmetries, symmetry, move);
+    grid = explode(grid, moves[length++]);
+    orbit = orbit_rank(symmetries, grid, &symmetry);
+  }
+  return length;
+}
+
+/** PLAYING IN THE FOG ********************************************************
+ * In fog mode some cells are hidden, so the player only knows the grid is one
+ * of those consistent with the cells they can see. What they know is a belief:
+ * the set of all possible grids, which is a 512 bit bitmap with one bit per
+ * grid. A sequence of moves solves the fog if it wins no matter which of
+ * those grids was the real one.
+ *
+ * A move can only be made if the cell is a star in every possible grid, and it
+ * must not make any of them lose. Since each move xors all grids with the same
+ * mask, applying it to a belief just moves bits around: the low 6 bits of the
+ * mask swap blocks of bits inside each 64 bit word, the high 3 bits swap whole
+ * words. All of this is a handful of word operations, no matter how many grids
+ * are in the belief. Grids that reach the winning grid are done and leave the
+ * belief, the fog is solved once the belief is empty.
+ *
+ * We find the shortest solution with a bfs over beliefs, using a hash set to
+ * avoid visiting the same belief twice.
+ */
+
+#define MAX_BELIEFS (1 << 15)
+// Returned when the search needs more than `MAX_BELIEFS` beliefs.
+#define TOO_MANY_BELIEFS -2
+
+typedef struct Belief {
+  uint64_t words[8];
+} Belief;
+
+typedef struct BeliefNode {
+  Belief belief;
+  int parent;
+  int move;
+} BeliefNode;
+
+typedef struct FogSearch {
+  // The beliefs holding all the grids with a star in each cell, index 0 is
+  // unused.
+  Belief stars_in[10];
+  // Nodes are stored in the order they're visited, which makes this the bfs
+  // queue as well.
+  BeliefNode nodes[MAX_BELIEFS];
+  // Open addressing hash set of visited beliefs: each slot is the index of a
+  // node plus one, 0 means it's free.
+  int slots[2 * MAX_BELIEFS];
+} FogSearch;
+
+// For each bit of the index, the bits of a word at positions where that bit
+// is 0.
+static const uint64_t low_halves[6] = {
+    0x5555555555555555, 0x3333333333333333, 0x0F0F0F0F0F0F0F0F,
+    0x00FF00FF00FF00FF, 0x0000FFFF0000FFFF, 0x00000000FFFFFFFF};
+
+static void add_to_belief(Belief *belief, Grid grid) {
+  belief->words[grid >> 6] |= (uint64_t)1 << (grid & 63);
+}
+
+static void remove_from_belief(Belief *belief, Grid grid) {
+  belief->words[grid >> 6] &= ~((uint64_t)1 << (grid & 63));
+}
+
+static bool belief_contains(Belief *belief, Grid grid) {
+  return belief->words[grid >> 6] & ((uint64_t)1 << (grid & 63));
+}
+
+static bool is_empty_belief(Belief *belief) {
+  uint64_t any = 0;
+  for (int w = 0; w < 8; w++) {
+    any |= belief->words[w];
+  }
+  return any == 0;
+}
+
+static uint64_t hash_belief(Belief *belief) {
+  uint64_t hash = 0;
+  for (int w = 0; w < 8; w++) {
+    hash = (hash ^ belief->words[w]) * 0x9E3779B97F4A7C15;
+  }
+  return hash ^ (hash >> 32);
+}
+
+/**
+ * The belief we get by xor-ing all of its grids with the given mask.
+ */
+static Belief xor_belief(Belief *belief, Grid mask) {
+  Belief result;
+  for (int w = 0; w < 8; w++) {
+    uint64_t word = belief->words[w];
+    for (int bit = 0; bit < 6; bit++) {
+      if (mask & (1 << bit)) {
+        int shift = 1 << bit;
+        word = ((word & low_halves[bit]) << shift) |
+               ((word >> shift) & low_halves[bit]);
+      }
+    }
+    result.words[w ^ (mask >> 6)] = word;
+  }
+  return result;
+}
+
+/**
+ * Makes a move on all the grids of the belief, returning `false` if the move
+ * can't be made: that is if the cell is not a star in one of the grids or if
+ * one of them would lose.
+ */
+static bool explode_belief(FogSearch *search, Belief *belief, int cell,
+                           Belief *result) {
+  uint64_t not_a_star = 0;
+  for (int w = 0; w < 8; w++) {
+    not_a_star |= belief->words[w] & ~search->stars_in[cell].words[w];
+  }
+  if (not_a_star != 0) {
+    return false;
+  }
+
+  *result = xor_belief(belief, move_mask(cell));
+  if (belief_contains(result, empty_grid)) {
+    return false;
+  }
+  remove_from_belief(result, winning_grid);
+  return true;
+}
+
+/**
+ * Returns the slot holding the node of the belief, or the empty slot where it
+ * should go if it wasn't visited yet.
+ */
+static int find_belief(FogSearch *search, Belief *belief) {
+  int mask = 2 * MAX_BELIEFS - 1;
+  for (int slot = hash_belief(belief) & mask; true; slot = (slot + 1) & mask) {
+    int node = search->slots[slot];
+    if (node == 0 || memcmp(&search->nodes[node - 1].belief, belief,
+                            sizeof(Belief)) == 0) {
+      return slot;
+    }
+  }
+}
+
+/**
+ * Adds a node for the belief unless it was already visited.
+ * Returns `false` if it was.
+ */
+static bool visit_belief(FogSearch *search, int *count, Belief *belief,
+                         int parent, int move) {
+  int slot = find_belief(search, belief);
+  if (search->slots[slot] != 0) {
+    return false;
+  }
+  search->nodes[*count] =
+      (BeliefNode){.belief = *belief, .parent = parent, .move = move};
+  search->slots[slot] = ++*count;
+  return true;
+}
+
+/**
+ * Finds the shortest sequence of moves that wins whatever the hidden cells are.
+ * `hidden` has a 1 for each cell that can't be seen, the value of those cells
+ * in `grid` is ignored.
+ *
+ * Returns the number of moves written in `moves`, or -1 if there's no such
+ * sequence (or not enough memory to look for it). Returns `TOO_MANY_BELIEFS`
+ * if the search ran out of its `MAX_BELIEFS` beliefs before it could tell.
+ */
+static int fog_winning_moves(Grid grid, Grid hidden, int moves[511]) {
+  FogSearch *search = (FogSearch *)star_calloc(1, sizeof(FogSearch));
+  if (search == NULL) {
+    return -1;
+  }
+
+  Belief initial = {{0}};
+  for (int i = 1; i <= 9; i++) {
+    for (int g = 0; g < 512; g++) {
+      if (is_star(g, i)) {
+        add_to_belief(&search->stars_in[i], g);
+      }
+    }
+  }
+  for (int g = 0; g < 512; g++) {
+    if ((g & ~hidden) == (grid & ~hidden)) {
+      add_to_belief(&initial, g);
+    }
+  }
+  remove_from_belief(&initial, winning_grid);
+
+  int count = 0;
+  int first = 0;
+  int found = -1;
+  bool truncated = false;
+  reset_solve_stats();
+  if (!belief_contains(&initial, empty_grid)) {
+    visit_belief(search, &count, &initial, -1, 0);
+  }
+
+  while (first < count && found < 0 && !truncated) {
+    record_frontier(count - first);
+    int node = first++;
+    solve_stats.nodes++;
+    if (is_empty_belief(&search->nodes[node].belief)) {
+      found = node;
+      break;
+    }
+
+    for (int i = 1; i <= 9; i++) {
+      Belief next;
+      if (!explode_belief(search, &search->nodes[node].belief, i, &next)) {
+        continue;
+      } else if (count == MAX_BELIEFS &&
+                 search->slots[find_belief(search, &next)] == 0) {
+        // Beliefs we already have don't need room, only new ones do.
+        truncated = true;
+        break;
+      }
+      visit_belief(search, &count, &next, node, i);
+    }
+  }
+
+  int length = truncated ? TOO_MANY_BELIEFS : -1;
+  if (found >= 0) {
+    length = 0;
+    for (int node = found; search->nodes[node].parent >= 0;
+         node = search->nodes[node].parent) {
+      moves[length++] = search->nodes[node].move;
+    }
+    for (int i = 0; i < length / 2; i++) {
+      int move = moves[i];
+      moves[i] = moves[length - 1 - i];
+      moves[length - 1 - i] = move;
+    }
+  }
+
+  free(search);
+  return length;
+}
+
+/** CONSTRAINED SOLVING *******************************************************
+ * Puzzles can add constraints on top of the usual rules: a cell can only be
+ * exploded a limited number of times (0 means it's locked) and there can be a
+ * limit on the total number of moves.
+ *
+ * A grid alone is no longer enough to know which moves we can make, we also
+ * need to know how many times each limited cell has been exploded. So the
+ * state of the search is the grid plus a counter for each limited cell, all
+ * packed in a single 32 bit word: the grid in the lowest 9 bits and each
+ * counter, using just as many bits as it needs, right after it.
+ * The limit on moves doesn't need a counter, it's just how deep the bfs goes.
+ *
+ * When the states fit in a few million slots the visited states are kept in a
+ * plain bitmap, otherwise in a hash set. Either way the memory for the search
+ * is sized after the number of possible states, so that a search with few
+ * constraints costs about as much as a plain bfs.
+ */
+
+#define MAX_CONSTRAINED_STATES (1 << 20)
+#define MAX_DENSE_STATE_BITS 24
+// Returned when the constraints need more states than we're willing to search.
+#define CONSTRAINTS_TOO_LARGE -2
+
+typedef struct Constraints {
+  // How many times each cell can be exploded, -1 means there's no limit. Index
+  // 0 is unused.
+  int max_explosions[10];
+  // -1 means there's no limit.
+  int max_moves;
+} Constraints;
+
+typedef struct StateLayout {
+  // Where the counter of each cell starts in the state and how many bits it
+  // takes, cells without a limit have no counter.
+  int shift[10];
+  int width[10];
+  int bits;
+} StateLayout;
+
+typedef struct ConstrainedNode {
+  uint32_t state;
+  int parent;
+  uint16_t depth;
+  uint8_t move;
+} ConstrainedNode;
+
+typedef struct ConstrainedSearch {
+  ConstrainedNode *nodes;
+  // A power of 2, at most `MAX_CONSTRAINED_STATES`.
+  uint32_t capacity;
+  // Either a bitmap with a bit for each possible state, or an open addressing
+  // hash set of states plus one (0 means the slot is free). Slots are 64 bits
+  // wide so that a state using all of the 32 bits still fits once incremented.
+  uint64_t *visited_bitmap;
+  uint64_t *visited_slots;
+} ConstrainedSearch;
+
+static Constraints no_constraints() {
+  Constraints constraints;
+  for (int i = 0; i < 10; i++) {
+    constraints.max_explosions[i] = -1;
+  }
+  constraints.max_moves = -1;
+  return constraints;
+}
+
+/**
+ * Decides where each counter goes in the state.
+ * Returns `false` if the state wouldn't fit in 32 bits.
+ */
+static bool layout_state(Constraints *constraints, StateLayout *layout) {
+  layout->bits = 9;
+  for (int i = 1; i <= 9; i++) {
+    int limit = constraints->max_explosions[i];
+    int width = 0;
+    while (limit > 0 && (limit >> width) > 0) {
+      width++;
+    }
+    layout->shift[i] = layout->bits;
+    layout->width[i] = width;
+    layout->bits += width;
+  }
+  return layout->bits <= 32;
+}
+
+/**
+ * The capacity of a search over states with the given layout, and the bytes
+ * its visited states take.
+ */
+static uint32_t constrained_capacity(StateLayout *layout) {
+  return layout->bits < 20 ? (uint32_t)1 << layout->bits
+                           : MAX_CONSTRAINED_STATES;
+}
+
+static size_t constrained_visited_bytes(StateLayout *layout) {
+  if (layout->bits <= MAX_DENSE_STATE_BITS) {
+    size_t words = layout->bits > 6 ? (size_t)1 << (layout->bits - 6) : 1;
+    return words * sizeof(uint64_t);
+  }
+  return 2 * constrained_capacity(layout) * sizeof(uint64_t);
+}
+
+/**
+ * Makes a move on a state, returning `false` if it's not allowed either by the
+ * rules or by the constraints.
+ */
+static bool constrained_successor(Constraints *constraints,
+                                  StateLayout *layout, uint32_t state,
+                                  int cell, uint32_t *successor) {
+  Grid grid = state & full_grid;
+  int limit = constraints->max_explosions[cell];
+  if (!is_star(grid, cell) || limit == 0) {
+    return false;
+  }
+
+  if (limit > 0) {
+    uint32_t counter_mask = ((uint32_t)1 << layout->width[cell]) - 1;
+    uint32_t count = (state >> layout->shift[cell]) & counter_mask;
+    if (count >= (uint32_t)limit) {
+      return false;
+    }
+    state += (uint32_t)1 << layout->shift[cell];
+  }
+
+  *successor = (state & ~(uint32_t)full_grid) | explode(grid, cell);
+  return true;
+}
+
+/**
+ * Returns the hash slot holding the state, or the free slot where it should go
+ * if it wasn't visited yet.
+ */
+static uint32_t find_state(ConstrainedSearch *search, uint32_t state) {
+  uint32_t mask = 2 * search->capacity - 1;
+  uint32_t slot = (state * 0x9E3779B1u) & mask;
+  for (; search->visited_slots[slot] != 0; slot = (slot + 1) & mask) {
+    if (search->visited_slots[slot] == (uint64_t)state + 1) {
+      break;
+    }
+  }
+  return slot;
+}
+
+static bool state_visited(ConstrainedSearch *search, uint32_t state) {
+  if (search->visited_bitmap != NULL) {
+    return search->visited_bitmap[state >> 6] & (uint64_t)1 << (state & 63);
+  }
+  return search->visited_slots[find_state(search, state)] != 0;
+}
+
+/**
+ * Marks a state as visited, returning `false` if it already was.
+ */
+static bool visit_state(ConstrainedSearch *search, uint32_t state) {
+  if (search->visited_bitmap != NULL) {
+    uint64_t bit = (uint64_t)1 << (state & 63);
+    bool visited = search->visited_bitmap[state >> 6] & bit;
+    search->visited_bitmap[state >> 6] |= bit;
+    return !visited;
+  }
+
+  uint32_t slot = find_state(search, state);
+  if (search->visited_slots[slot] != 0) {
+    return false;
+  }
+  search->visited_slots[slot] = (uint64_t)state + 1;
+  return true;
+}
+
+/**
+ * Finds the shortest sequence of moves from `initial` to the winning grid that
+ * respects the constraints, writing it in `moves`.
+ *
+ * Returns the number of moves, or -1 if there's no such sequence (or not
+ * enough memory to look for it). Returns `CONSTRAINTS_TOO_LARGE` if the
+ * constraints need more than 32 bits of state, or if the search ran out of
+ * its `MAX_CONSTRAINED_STATES` states before it could tell.
+ */
+static int constrained_winning_moves(Constraints *constraints, Grid initial,
+                                     int moves[511]) {
+  StateLayout layout;
+  if (!layout_state(constraints, &layout)) {
+    return CONSTRAINTS_TOO_LARGE;
+  }
+
+  ConstrainedSearch search;
+  search.capacity = constrained_capacity(&layout);
+  search.nodes =
+      (ConstrainedNode *)star_malloc(sizeof(ConstrainedNode) * search.capacity);
+  search.visited_bitmap = NULL;
+  search.visited_slots = NULL;
+  size_t visited_bytes = constrained_visited_bytes(&layout);
+  if (layout.bits <= MAX_DENSE_STATE_BITS) {
+    search.visited_bitmap = (uint64_t *)star_calloc(1, visited_bytes);
+  } else {
+    search.visited_slots = (uint64_t *)star_calloc(1, visited_bytes);
+  }
+  if (search.nodes == NULL ||
+      (search.visited_bitmap == NULL && search.visited_slots == NULL)) {
+    free(search.nodes);
+    free(search.visited_bitmap);
+    free(search.visited_slots);
+    return -1;
+  }
+
+  int count = 0;
+  int first = 0;
+  int found = -1;
+  bool truncated = false;
+  reset_solve_stats();
+  search.nodes[count++] =
+      (ConstrainedNode){.state = initial, .parent = -1, .depth = 0};
+  visit_state(&search, initial);
+
+  while (first < count && !truncated) {
+    record_frontier(count - first);
+    ConstrainedNode node = search.nodes[first++];
+    solve_stats.nodes++;
+    Outcome grid_outcome = outcome(node.state & full_grid);
+    if (grid_outcome == Won) {
+      found = first - 1;
+      break;
+    } else if (grid_outcome == Lost || node.depth == constraints->max_moves) {
+      continue;
+    }
+
+    for (int i = 1; i <= 9; i++) {
+      uint32_t successor;
+      if (!constrained_successor(constraints, &layout, node.state, i,
+                                 &successor)) {
+        continue;
+      } else if (count == (int)search.capacity &&
+                 !state_visited(&search, successor)) {
+        // States we already have don't need room, only new ones do.
+        truncated = true;
+        break;
+      } else if (visit_state(&search, successor)) {
+        search.nodes[count++] = (ConstrainedNode){.state = successor,
+                                                   .parent = first - 1,
+                                                   .depth = node.depth + 1,
+                                                   .move = i};
+      }
+    }
+  }
+
+  int length = truncated ? CONSTRAINTS_TOO_LARGE : -1;
+  if (found >= 0) {
+    length = search.nodes[found].depth;
+    for (int node = found, i = length - 1; i >= 0;
+         node = search.nodes[node].parent, i--) {
+      moves[i] = search.nodes[node].move;
+    }
+  }
+
+  free(search.nodes);
+  free(search.visited_bitmap);
+  free(search.visited_slots);
+  return length;
+}
+
+/** MULTI-SOURCE BFS **********************************************************
+ * When many queries for different starting grids come in at once, their
+ * searches end up visiting the same grids over and over. Instead we can run a
+ * single bfs for up to 64 queries: each grid holds a 64 bit mask with a bit
+ * for each query that has reached it. Expanding a grid moves all of its
+ * queries forward at once with a couple of word operations, so the work is
+ * shared by all the queries that pass through it.
+ *
+ * To rebuild each path we keep the frontier of every layer: going backwards
+ * from the winning grid, the previous grid of a query's path is any grid that
+ * query reached in the previous layer and that leads to the current one.
+ */
+
+#define MAX_QUERIES 64
+
+typedef uint64_t QueryMask;
+
+/**
+ * Finds the shortest winning path for each of the `count` (at most
+ * `MAX_QUERIES`) starting grids. For each query it writes the number of moves,
+ * or -1 if there's no way to win, in `lengths` and the moves in `moves`.
+ *
+ * Returns `false` if the search couldn't allocate the memory it needed.
+ */
+static bool multi_source_winning_moves(Grid *starts, int count, int *lengths,
+                                       int moves[][511]) {
+  QueryMask visited[512] = {0};
+  QueryMask pending = 0;
+  // `layers[d]` is the frontier of layer `d`, for each grid the queries that
+  // reached it after exactly `d` moves.
+  QueryMask(*layers)[512] = NULL;
+  int depth = 0;
+  int capacity = 0;
+  reset_solve_stats();
+
+  for (int q = 0; q < count; q++) {
+    lengths[q] = -1;
+    pending |= (QueryMask)1 << q;
+  }
+
+  while (pending != 0) {
+    if (depth == capacity) {
+      capacity = capacity == 0 ? 16 : 2 * capacity;
+      QueryMask(*grown)[512] = (QueryMask(*)[512])star_realloc(
+          layers, sizeof(QueryMask[512]) * capacity);
+      if (grown == NULL) {
+        free(layers);
+        return false;
+      }
+      layers = grown;
+    }
+
+    QueryMask *frontier = layers[depth];
+    if (depth == 0) {
+      memset(frontier, 0, sizeof(QueryMask[512]));
+      for (int q = 0; q < count; q++) {
+        frontier[starts[q]] |= (QueryMask)1 << q;
+        visited[starts[q]] |= (QueryMask)1 << q;
+      }
+    } else {
+      QueryMask *previous = layers[depth - 1];
+      memset(frontier, 0, sizeof(QueryMask[512]));
+      for (int grid = 0; grid < 512; grid++) {
+        QueryMask queries = previous[grid] & pending;
+        if (queries == 0 || outcome(grid) != Continue) {
+          continue;
+        }
+        solve_stats.nodes++;
+        for (int i = 1; i <= 9; i++) {
+          if (is_star(grid, i)) {
+            Grid new_grid = explode(grid, i);
+            QueryMask arrived = queries & ~visited[new_grid];
+            frontier[new_grid] |= arrived;
+            visited[new_grid] |= arrived;
+          }
+        }
+      }
+    }
+
+    // The queries that reached the winning grid in this layer are done.
+    QueryMask won = frontier[winning_grid] & pending;
+    for (int q = 0; q < count; q++) {
+      if (won & ((QueryMask)1 << q)) {
+        lengths[q] = depth;
+      }
+    }
+    pending &= ~won;
+
+    QueryMask alive = 0;
+    uint32_t frontier_size = 0;
+    for (int grid = 0; grid < 512; grid++) {
+      alive |= frontier[grid];
+      frontier_size += frontier[grid] != 0;
+    }
+    record_frontier(frontier_size);
+    pending &= alive;
+    depth++;
+  }
+
+  for (int q = 0; q < count; q++) {
+    QueryMask query = (QueryMask)1 << q;
+    Grid grid = winning_grid;
+    for (int d = lengths[q]; d > 0; d--) {
+      for (int i = 1; i <= 9; i++) {
+        Grid previous = grid ^ move_mask(i);
+        if (is_star(previous, i) && (layers[d - 1][previous] & query) &&
+            outcome(previous) == Continue) {
+          moves[q][d - 1] = i;
+          grid = previous;
+          break;
+        }
+      }
+    }
+  }
+
+  free(layers);
+  return true;
+}
+
+/** DEPTH-FIRST SEARCH WITH A TRANSPOSITION TABLE *****************************
+ * Iterative deepening only ever keeps the current path in memory, which is
+ * what makes it viable on boards far too big for a visited set. The price is
+ * that it reaches the same grid over and over, through different orders of
+ * the same moves and again in each iteration.
+ *
+ * Commuting moves are only tried in ascending order (see
+ * `find_commuting_moves`), which already prunes most of the orders that lead
+ * to the same grid. On top of that a transposition table remembers, for as
+ * many grids as fit in a fixed amount of memory, the largest number of moves
+ * that was proven not to be enough to win from there. Which moves are tried
+ * depends on the last one, so entries are for a grid and the move that
+ * reached it. That's true no matter where the search started or how deep
+ * the current iteration is, so a single table can be shared by all searches,
+ * even running at the same time on different threads.
+ *
+ * The table is made of buckets of 4 entries, 64 bytes each so that a bucket
+ * fits in a single cache line. Entries are written without any locking: each
+ * one is stored as its data and its data xor-ed with the key, so an entry torn
+ * by two threads writing it at once simply doesn't match any key and is
+ * ignored. When a bucket is full the entry with the smallest bound goes, since
+ * deeper bounds took more work to prove and prune more.
+ */
+
+#define BUCKET_ENTRIES 4
+// Bounds are stored in 8 bits.
+#define MAX_DEPTH_FIRST_MOVES 255
+
+typedef struct TranspositionEntry {
+  atomic_uint_least64_t check;
+  atomic_uint_least64_t data;
+} TranspositionEntry;
+
+typedef struct TranspositionBucket {
+  _Alignas(64) TranspositionEntry entries[BUCKET_ENTRIES];
+} TranspositionBucket;
+
+typedef struct TranspositionTable {
+  TranspositionBucket *buckets;
+  // Always a power of 2.
+  uint64_t bucket_count;
+  void *allocation;
+} TranspositionTable;
+
+/**
+ * Returns a table taking at most `bytes` (but at least a bucket), or `NULL` if
+ * there's not enough memory.
+ */
+static TranspositionTable *new_transposition_table(size_t bytes) {
+  TranspositionTable *table =
+      (TranspositionTable *)star_malloc(sizeof(TranspositionTable));
+  if (table == NULL) {
+    return NULL;
+  }
+
+  table->bucket_count = 1;
+  while (table->bucket_count * 2 * sizeof(TranspositionBucket) <= bytes) {
+    table->bucket_count *= 2;
+  }
+  // Leaves room to align the buckets to a cache line.
+  table->allocation = star_calloc(
+      1, table->bucket_count * sizeof(TranspositionBucket) + 64);
+  if (table->allocation == NULL) {
+    free(table);
+    return NULL;
+  }
+  table->buckets =
+      (TranspositionBucket *)(((uintptr_t)table->allocation + 63) &
+                              ~(uintptr_t)63);
+  return table;
+}
+
+static void free_transposition_table(TranspositionTable *table) {
+  free(table->allocation);
+  free(table);
+}
+
+// Entries hold the grid in the lowest 16 bits, then the last move in 4 bits
+// and the bound in the remaining ones.
+static uint64_t transposition_data(Grid grid, int last_move, int bound) {
+  return (uint64_t)bound << 20 | (uint64_t)last_move << 16 | grid;
+}
+
+static uint64_t transposition_key(uint64_t data) {
+  // Never 0, so that an empty entry matches no grid.
+  return ((data & 0xFFFFF) + 1) * 0x9E3779B97F4A7C15;
+}
+
+static TranspositionBucket *transposition_bucket(TranspositionTable *table,
+                                                 uint64_t key) {
+  return &table->buckets[(key >> 32) & (table->bucket_count - 1)];
+}
+
+/**
+ * Returns the largest number of moves known not to be enough to win from
+ * `grid` reached with `last_move`, or -1 if there's nothing in the table.
+ */
+static int probe_transposition(TranspositionTable *table, Grid grid,
+                               int last_move) {
+  uint64_t state = transposition_data(grid, last_move, 0);
+  uint64_t key = transposition_key(state);
+  TranspositionBucket *bucket = transposition_bucket(table, key);
+  for (int i = 0; i < BUCKET_ENTRIES; i++) {
+    uint64_t data =
+        atomic_load_explicit(&bucket->entries[i].data, memory_order_relaxed);
+    uint64_t check =
+        atomic_load_explicit(&bucket->entries[i].check, memory_order_relaxed);
+    if ((check ^ data) == key && (data & 0xFFFFF) == state) {
+      return data >> 20;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Records that `bound` moves are not enough to win from `grid` reached with
+ * `last_move`.
+ */
+static void store_transposition(TranspositionTable *table, Grid grid,
+                                int last_move, int bound) {
+  uint64_t state = transposition_data(grid, last_move, 0);
+  uint64_t key = transposition_key(state);
+  TranspositionBucket *bucket = transposition_bucket(table, key);
+  int replaced = 0;
+  int replaced_bound = MAX_DEPTH_FIRST_MOVES + 1;
+  for (int i = 0; i < BUCKET_ENTRIES; i++) {
+    uint64_t data =
+        atomic_load_explicit(&bucket->entries[i].data, memory_order_relaxed);
+    uint64_t check =
+        atomic_load_explicit(&bucket->entries[i].check, memory_order_relaxed);
+    // Empty and torn entries are the first to go.
+    bool valid = (check ^ data) == transposition_key(data);
+    int entry_bound = valid ? (int)(data >> 20) : -1;
+    if (valid && (data & 0xFFFFF) == state) {
+      if (entry_bound >= bound) {
+        return;
+      }
+      replaced = i;
+      break;
+    } else if (entry_bound < replaced_bound) {
+      replaced = i;
+      replaced_bound = entry_bound;
+    }
+  }
+
+  uint64_t data = transposition_data(grid, last_move, bound);
+  atomic_store_explicit(&bucket->entries[replaced].data, data,
+                        memory_order_relaxed);
+  atomic_store_explicit(&bucket->entries[replaced].check, data ^ key,
+                        memory_order_relaxed);
+}
+
+typedef struct DepthFirstSearch {
+  TranspositionTable *table;
+  uint16_t forbidden_after[10];
+  // Moves after which the same moves are forbidden share their entries, this
+  // is the smallest move they share them with.
+  int entry_move[10];
+  int *moves;
+} DepthFirstSearch;
+
+/**
+ * Looks for a way to win from `grid` in at most `moves_left` moves, writing
+ * its moves from `moves[made]` on. Returns the number of moves made in the
+ * end, or -1 if there's no such way.
+ */
+static int depth_first_search(DepthFirstSearch *search, Grid grid,
+                              int last_move, int moves_left, int made) {
+  solve_stats.nodes++;
+  record_frontier(made);
+  TranspositionTable *table = search->table;
+  if (grid == winning_grid) {
+    return made;
+  } else if (moves_left == 0 ||
+             (table != NULL &&
+              probe_transposition(table, grid, search->entry_move[last_move]) >=
+                  moves_left)) {
+    return -1;
+  }
+
+  for (int cell = 1; cell <= 9; cell++) {
+    if (!is_star(grid, cell) ||
+        (search->forbidden_after[last_move] & (1 << (cell - 1)))) {
+      continue;
+    }
+    search->moves[made] = cell;
+    int length = depth_first_search(search, explode(grid, cell), cell,
+                                    moves_left - 1, made + 1);
+    if (length >= 0) {
+      return length;
+    }
+  }
+
+  if (table != NULL) {
+    store_transposition(table, grid, search->entry_move[last_move],
+                        moves_left);
+  }
+  return -1;
+}
+
+/**
+ * Same as `shortest_winning_moves`, with an iterative deepening search that
+ * uses the given transposition table, if any. Gives up, returning -1, past
+ * `MAX_DEPTH_FIRST_MOVES` moves.
+ */
+static int depth_first_winning_moves(TranspositionTable *table, Grid grid,
+                                     int moves[511]) {
+  DepthFirstSearch search = {.table = table, .moves = moves};
+  find_commuting_moves(search.forbidden_after);
+  for (int move = 0; move <= 9; move++) {
+    search.entry_move[move] = 0;
+    while (search.forbidden_after[search.entry_move[move]] !=
+           search.forbidden_after[move]) {
+      search.entry_move[move]++;
+    }
+  }
+  reset_solve_stats();
+  for (int limit = 0; limit <= MAX_DEPTH_FIRST_MOVES; limit++) {
+    if (table != NULL && probe_transposition(table, grid, 0) >= limit) {
+      continue;
+    }
+    int length = depth_first_search(&search, grid, 0, limit, 0);
+    if (length >= 0) {
+      return length;
+    }
+  }
+  return -1;
+}
+
+/** PRINTING AND PARSING ******************************************************/
+
+static void print_grid(Grid grid) {
+  printf("%c%c%c\n%c%c%c\n%c%c%c", cell1 & grid ? '*' : '.',
+         cell2 & grid ? '*' : '.', cell3 & grid ? '*' : '.',
+         cell4 & grid ? '*' : '.', cell5 & grid ? '*' : '.',
+         cell6 & grid ? '*' : '.', cell7 & grid ? '*' : '.',
+         cell8 & grid ? '*' : '.', cell9 & grid ? '*' : '.');
+}
+
+/**
+ * Prints the sequence of moves leading to victory, one per line.
+ * To see all the intermediate grids as well, use `render_steps`.
+ */
+static void print_path_loop(Path *path) {
+  if (path == NULL) {
+    return;
+  }
+  print_path_loop(path->rest);
+  printf("%d\n", path->move);
+}
+
+static void print_path(Path *path) {
+  if (path == NULL) {
+    printf("-1");
+  } else {
+    print_path_loop(path);
+  }
+}
+
+/**
+ * Turns a string into a grid.
+ * Returns an `error_grid` if the given string contains invalid characters or
+ * more characters than expected.
+ */
+static Grid parse(char *input) {
+  char a, b, c, d, e, f, g, h, i;
+  if (strlen(input) != 11) {
+    return error_grid;
+  }
+
+  sscanf(input, "%c%c%c\n%c%c%c\n%c%c%c", &a, &b, &c, &d, &e, &f, &g, &h, &i);
+
+  Grid grid = empty_grid;
+  grid = a == '*' ? (cell1 | grid) : (a == '.' ? grid : error_grid);
+  grid = b == '*' ? (cell2 | grid) : (b == '.' ? grid : error_grid);
+  grid = c == '*' ? (cell3 | grid) : (c == '.' ? grid : error_grid);
+  grid = d == '*' ? (cell4 | grid) : (d == '.' ? grid : error_grid);
+  grid = e == '*' ? (cell5 | grid) : (e == '.' ? grid : error_grid);
+  grid = f == '*' ? (cell6 | grid) : (f == '.' ? grid : error_grid);
+  grid = g == '*' ? (cell7 | grid) : (g == '.' ? grid : error_grid);
+  grid = h == '*' ? (cell8 | grid) : (h == '.' ? grid : error_grid);
+  grid = i == '*' ? (cell9 | grid) : (i == '.' ? grid : error_grid);
+  return grid;
+}
+
+/**
+ * Turns a command line argument into a grid. Since newlines are awkward to type
+ * in a shell, rows can also be separated by a `/`: `*../.*./..*`.
+ */
+static Grid parse_argument(char *argument) {
+  char input[12];
+  if (strlen(argument) != 11) {
+    return error_grid;
+  }
+
+  for (int i = 0; i < 11; i++) {
+    input[i] = argument[i] == '/' ? '\n' : argument[i];
+  }
+  input[11] = '\0';
+  return parse(input);
+}
+
+/**
+ * The opposite of `parse_argument`: writes the grid in `output` with its rows
+ * separated by a `/`.
+ */
+static void format_argument(Grid grid, char output[12]) {
+  for (int cell = 1, i = 0; cell <= 9; cell++, i++) {
+    if (cell == 4 || cell == 7) {
+      output[i++] = '/';
+    }
+    output[i] = is_star(grid, cell) ? '*' : '.';
+  }
+  output[11] = '\0';
+}
+
+/** RENDERING STEP BY STEP ****************************************************
+ * Renders every intermediate grid of a solution, for tutorials and the like.
+ *
+ * All the formatting happens once, when the renderer is set up: each of the 8
+ * possible rows and each of the 9 moves gets its text in the chosen style.
+ * Rendering a grid then boils down to copying three rows out of the table into
+ * a buffer that is reused from one solution to the next.
+ */
+
+#define MAX_GLYPHS 48
+
+typedef enum RenderStyle { TextStyle, HtmlStyle, AnsiStyle } RenderStyle;
+
+typedef struct Glyphs {
+  char text[MAX_GLYPHS];
+  int length;
+} Glyphs;
+
+typedef struct Renderer {
+  // Indexed by the three cells of a row, the leftmost one in the highest bit.
+  Glyphs rows[8];
+  // Index 0 introduces the initial grid, the others the move with that number.
+  Glyphs steps[10];
+  Glyphs grid_start;
+  Glyphs grid_end;
+
+  char *buffer;
+  long capacity;
+} Renderer;
+
+/**
+ * Records the length of the text `snprintf` just wrote, which returns the
+ * length the text would have had if it wasn't cut to fit.
+ */
+static void fit_glyphs(Glyphs *glyphs, int length) {
+  int longest = (int)sizeof(glyphs->text) - 1;
+  glyphs->length = length < 0 ? 0 : length > longest ? longest : length;
+}
+
+static void set_glyphs(Glyphs *glyphs, const char *text) {
+  fit_glyphs(glyphs,
+             snprintf(glyphs->text, sizeof(glyphs->text), "%s", text));
+}
+
+/**
+ * Sets up a renderer for the given style, returns `false` if the style is not
+ * known.
+ */
+static bool init_renderer(Renderer *renderer, RenderStyle style) {
+  const char *star, *no_star, *row_end;
+  const char *first_step, *step_format;
+  const char *grid_start, *grid_end;
+  switch (style) {
+  case TextStyle:
+    star = "*", no_star = ".", row_end = "\n";
+    first_step = "Initial grid:\n", step_format = "Explode %d:\n";
+    grid_start = "", grid_end = "\n";
+    break;
+  case HtmlStyle:
+    star = "&#9733;", no_star = "&middot;", row_end = "\n";
+    first_step = "<p>Initial grid</p>", step_format = "<p>Explode %d</p>";
+    grid_start = "<pre>", grid_end = "</pre>\n";
+    break;
+  case AnsiStyle:
+    star = "\x1b[1;33m*\x1b[0m", no_star = "\x1b[2m.\x1b[0m", row_end = "\n";
+    first_step = "Initial grid:\n", step_format = "Explode \x1b[1m%d\x1b[0m:\n";
+    grid_start = "", grid_end = "\n";
+    break;
+  default:
+    return false;
+  }
+
+  for (int row = 0; row < 8; row++) {
+    Glyphs *glyphs = &renderer->rows[row];
+    fit_glyphs(glyphs, snprintf(glyphs->text, sizeof(glyphs->text),
+                                "%s%s%s%s", row & 4 ? star : no_star,
+                                row & 2 ? star : no_star,
+                                row & 1 ? star : no_star, row_end));
+  }
+  set_glyphs(&renderer->steps[0], first_step);
+  for (int move = 1; move <= 9; move++) {
+    Glyphs *step = &renderer->steps[move];
+    fit_glyphs(step,
+               snprintf(step->text, sizeof(step->text), step_format, move));
+  }
+  set_glyphs(&renderer->grid_start, grid_start);
+  set_glyphs(&renderer->grid_end, grid_end);
+  renderer->buffer = NULL;
+  renderer->capacity = 0;
+  return true;
+}
+
+static void free_renderer(Renderer *renderer) {
+  free(renderer->buffer);
+  renderer->buffer = NULL;
+  renderer->capacity = 0;
+}
+
+static char *append_glyphs(char *out, Glyphs *glyphs) {
+  memcpy(out, glyphs->text, glyphs->length);
+  return out + glyphs->length;
+}
+
+/**
+ * Renders the initial grid followed by each of the `length` moves and the grid
+ * it leads to. The result is left in the renderer's buffer, which is only
+ * valid until the next call. Returns the number of bytes rendered, or -1 if
+ * the buffer couldn't grow.
+ */
+static long render_steps(Renderer *renderer, Grid initial, const int *moves,
+                         int length) {
+  long needed = (length + 1) * 6 * MAX_GLYPHS;
+  if (needed > renderer->capacity) {
+    char *buffer = (char *)star_realloc(renderer->buffer, needed);
+    if (buffer == NULL) {
+      return -1;
+    }
+    renderer->buffer = buffer;
+    renderer->capacity = needed;
+  }
+
+  char *out = renderer->buffer;
+  Grid grid = initial;
+  for (int step = 0; step <= length; step++) {
+    if (step > 0) {
+      grid = explode(grid, moves[step - 1]);
+    }
+    out = append_glyphs(out, &renderer->steps[step > 0 ? moves[step - 1] : 0]);
+    out = append_glyphs(out, &renderer->grid_start);
+    out = append_glyphs(out, &renderer->rows[(grid >> 6) & 7]);
+    out = append_glyphs(out, &renderer->rows[(grid >> 3) & 7]);
+    out = append_glyphs(out, &renderer->rows[grid & 7]);
+    out = append_glyphs(out, &renderer->grid_end);
+  }
+  return out - renderer->buffer;
+}
+
+/** FLIGHT RECORDER ***********************************************************
+ * When a solve is unexpectedly slow we want to know what it was doing. Each
+ * thread keeps a summary of its most recent solves in a ring buffer, and a
+ * second ring only for the solves that took longer than
+ * `slow_solve_threshold` nanoseconds, so those stick around much longer.
+ *
+ * Rings are only written by the thread they belong to, so recording a solve
+ * needs no locks: it's a few stores and bumping a couple of counters. Rings
+ * can be dumped at any time with `dump_flight_recorders`, or by sending
+ * `SIGUSR1` to the process: the next thread to record a solve dumps them on
+ * stderr. Each entry has a sequence number that's odd while it's being
+ * written (a seqlock), so a dump skips entries that change under its feet
+ * instead of showing them half written.
+ *
+ * A thread gives its recorder back when it exits, so that threads coming and
+ * going never run out of them. The next thread to claim it keeps on writing
+ * in the same rings.
+ */
+
+#define RECENT_SOLVES 256
+#define SLOW_SOLVES 64
+#define MAX_FLIGHT_RECORDERS 64
+
+typedef enum Engine {
+  BfsEngine,
+  TableEngine,
+  ContextEngine,
+  ConstructiveEngine,
+  DenseEngine,
+  OrbitEngine,
+  FogEngine,
+  ConstrainedEngine,
+  LandmarkEngine,
+  DepthFirstEngine,
+  MultiSourceEngine
+} Engine;
+
+static const char *engine_names[] = {
+    "bfs",   "table", "context",     "constructive", "dense",
+    "orbit", "fog",   "constrained", "landmark",     "depth-first",
+    "multi-source"};
+
+typedef struct SolveRecord {
+  uint64_t finished_at;
+  uint64_t duration;
+  uint32_t nodes;
+  uint32_t frontier_peak;
+  Grid grid;
+  uint8_t engine;
+} SolveRecord;
+
+// A `SolveRecord` as it's stored in a ring: packed in words that can be read
+// while they're being written.
+typedef struct RecordSlot {
+  atomic_uint sequence;
+  atomic_uint_least64_t words[4];
+} RecordSlot;
+
+typedef struct FlightRecorder {
+  // How many solves were ever written to each ring, the latest one is at
+  // `(written - 1) % size`.
+  atomic_uint recent_written;
+  atomic_uint slow_written;
+  RecordSlot recent[RECENT_SOLVES];
+  RecordSlot slow[SLOW_SOLVES];
+} FlightRecorder;
+
+// Each thread claims one of these the first time it records a solve and
+// gives it back when it exits, a bit is set in `flight_recorders_claimed` for
+// each recorder that's taken. Threads that come while all of them are taken
+// are not recorded.
+static FlightRecorder flight_recorders[MAX_FLIGHT_RECORDERS];
+static atomic_uint_least64_t flight_recorders_claimed;
+static _Thread_local int flight_recorder_slot = -1;
+static pthread_key_t flight_recorder_key;
+static pthread_once_t flight_recorder_key_once = PTHREAD_ONCE_INIT;
+
+static uint64_t slow_solve_threshold = 100000;
+static volatile sig_atomic_t flight_recorder_dump_requested = 0;
+
+/** Nanoseconds from some fixed point in the past. */
+static uint64_t now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/**
+ * Reads a record, returning `false` if it was being written in the meantime.
+ */
+static bool read_record(RecordSlot *slot, SolveRecord *record) {
+  unsigned int sequence =
+      atomic_load_explicit(&slot->sequence, memory_order_acquire);
+  uint64_t words[4];
+  for (int i = 0; i < 4; i++) {
+    words[i] = atomic_load_explicit(&slot->words[i], memory_order_relaxed);
+  }
+  atomic_thread_fence(memory_order_acquire);
+  if (sequence % 2 != 0 ||
+      atomic_load_explicit(&slot->sequence, memory_order_relaxed) !=
+          sequence) {
+    return false;
+  }
+
+  record->finished_at = words[0];
+  record->duration = words[1];
+  record->nodes = words[2] >> 32;
+  record->frontier_peak = words[2] & 0xFFFFFFFF;
+  record->grid = words[3] & 0xFFFF;
+  record->engine = words[3] >> 16;
+  return true;
+}
+
+static void dump_ring(FILE *out, int thread, const char *ring,
+                      RecordSlot *slots, unsigned int written, int size) {
+  unsigned int first = written > (unsigned int)size ? written - size : 0;
+  for (unsigned int i = first; i < written; i++) {
+    SolveRecord record;
+    if (!read_record(&slots[i % size], &record)) {
+      continue;
+    }
+    char grid[12];
+    format_argument(record.grid, grid);
+    fprintf(out, "%d\t%s\t%llu\t%s\t%s\t%llu\t%u\t%u\n", thread, ring,
+            (unsigned long long)record.finished_at,
+            engine_names[record.engine], grid,
+            (unsigned long long)record.duration, record.nodes,
+            record.frontier_peak);
+  }
+}
+
+/**
+ * Writes all the recorded solves of all threads, one per line.
+ */
+static void dump_flight_recorders(FILE *out) {
+  fprintf(out, "thread\tring\tfinished_at\tengine\tgrid\tduration_ns\tnodes"
+               "\tfrontier_peak\n");
+  for (int thread = 0; thread < MAX_FLIGHT_RECORDERS; thread++) {
+    FlightRecorder *recorder = &flight_recorders[thread];
+    dump_ring(out, thread, "slow", recorder->slow,
+              atomic_load_explicit(&recorder->slow_written,
+                                   memory_order_acquire),
+              SLOW_SOLVES);
+    dump_ring(out, thread, "recent", recorder->recent,
+              atomic_load_explicit(&recorder->recent_written,
+                                   memory_order_acquire),
+              RECENT_SOLVES);
+  }
+  fflush(out);
+}
+
+static void request_flight_recorder_dump(int signal) {
+  (void)signal;
+  flight_recorder_dump_requested = 1;
+}
+
+static void write_record(atomic_uint *written, RecordSlot *ring, int size,
+                         SolveRecord *record) {
+  unsigned int position =
+      atomic_load_explicit(written, memory_order_relaxed);
+  RecordSlot *slot = &ring[position % size];
+  unsigned int sequence =
+      atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+  atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  uint64_t words[4] = {record->finished_at, record->duration,
+                       (uint64_t)record->nodes << 32 | record->frontier_peak,
+                       (uint64_t)record->engine << 16 | record->grid};
+  for (int i = 0; i < 4; i++) {
+    atomic_store_explicit(&slot->words[i], words[i], memory_order_relaxed);
+  }
+  atomic_store_explicit(&slot->sequence, sequence + 2, memory_order_release);
+  atomic_store_explicit(written, position + 1, memory_order_release);
+}
+
+static void release_flight_recorder(void *slot) {
+  uint64_t bit = (uint64_t)1 << ((intptr_t)slot - 1);
+  atomic_fetch_and(&flight_recorders_claimed, ~bit);
+}
+
+static void create_flight_recorder_key() {
+  pthread_key_create(&flight_recorder_key, release_flight_recorder);
+}
+
+/**
+ * Claims a free recorder for the calling thread, if there's one left.
+ */
+static void claim_flight_recorder() {
+  pthread_once(&flight_recorder_key_once, create_flight_recorder_key);
+  uint64_t claimed = atomic_load(&flight_recorders_claimed);
+  while (~claimed != 0) {
+    int slot = __builtin_ctzll(~claimed);
+    if (atomic_compare_exchange_weak(&flight_recorders_claimed, &claimed,
+                                     claimed | (uint64_t)1 << slot)) {
+      flight_recorder_slot = slot;
+      // Stored plus one, since a `NULL` value doesn't call the destructor.
+      pthread_setspecific(flight_recorder_key, (void *)(intptr_t)(slot + 1));
+      return;
+    }
+  }
+}
+
+/** REQUEST CAPTURE ***********************************************************
+ * To reproduce a problem offline it's handy to have the exact solves that
+ * caused it, so solves can be captured to a compact binary trace file.
+ *
+ * Each thread appends its solves to a buffer of its own, when that is full it
+ * is handed over to a background thread that writes it to the file: solving
+ * threads never wait for the disk and only take a lock once every
+ * `CAPTURE_RECORDS` solves. So that a quiet thread doesn't sit on its solves
+ * forever, every `CAPTURE_MAX_DELAY` nanoseconds the writer also writes out
+ * whatever the buffers being filled hold so far: each buffer publishes how
+ * many records it has, and those are never touched again until the writer
+ * itself recycles the buffer. Everything written is flushed right away.
+ *
+ * Solves are dropped (and counted) rather than slowed down: when the writer
+ * can't keep up and there are no free buffers left, when the thread couldn't
+ * get a flight recorder (whose slot picks its buffer), or when the file can't
+ * be written.
+ *
+ * Once the file grows past its size limit it's rotated: `FILE` becomes
+ * `FILE.1`, `FILE.1` becomes `FILE.2` and so on, keeping at most
+ * `CAPTURE_FILES` files around.
+ *
+ * Each file starts with the magic `STARTRC1`, followed by records of
+ * `CAPTURE_RECORD_SIZE` bytes, all numbers are little endian:
+ *
+ *     u64 timestamp (nanoseconds since the epoch)
+ *     u32 latency (nanoseconds, saturated at `UINT32_MAX`)
+ *     u16 rule set, u16 grid, u8 engine, u8 reserved
+ */
+
+#define CAPTURE_RECORDS 512
+#define CAPTURE_RECORD_SIZE 18
+#define CAPTURE_BUFFERS (2 * MAX_FLIGHT_RECORDERS)
+#define CAPTURE_FILES 4
+#define CAPTURE_MAX_DELAY 1000000000
+
+// There's a single set of rules for now, the one implemented by `explode`.
+static const uint16_t rule_set = 0;
+
+static const char capture_magic[8] = {'S', 'T', 'A', 'R', 'T', 'R', 'C', '1'};
+
+typedef struct CaptureBuffer {
+  // Only written by the thread filling the buffer, `flushed` only by the
+  // writer.
+  atomic_int count;
+  int flushed;
+  unsigned char bytes[CAPTURE_RECORDS * CAPTURE_RECORD_SIZE];
+  struct CaptureBuffer *next;
+} CaptureBuffer;
+
+typedef struct Capture {
+  char path[1024];
+  FILE *file;
+  long file_bytes;
+  long max_file_bytes;
+  atomic_long dropped;
+
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  bool stopping;
+  // Buffers nobody is using, and buffers waiting to be written, in order.
+  CaptureBuffer *free_buffers;
+  CaptureBuffer *full_first;
+  CaptureBuffer *full_last;
+  // The buffer each thread is filling, indexed by its flight recorder slot.
+  _Atomic(CaptureBuffer *) filling[MAX_FLIGHT_RECORDERS];
+  CaptureBuffer buffers[CAPTURE_BUFFERS];
+} Capture;
+
+// Capturing is on if this is not `NULL`. It must only be started and stopped
+// when there's no solve in progress.
+static Capture *capture = NULL;
+
+/** Nanoseconds since the epoch. */
+static uint64_t wall_clock() {
+  struct timespec time;
+  clock_gettime(CLOCK_REALTIME, &time);
+  return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/**
+ * Opens the capture file, appending to it if asked to and it's already there:
+ * only a new file gets the magic.
+ */
+static bool open_capture_file(Capture *capture, bool append) {
+  capture->file = fopen(capture->path, append ? "ab" : "wb");
+  if (capture->file == NULL) {
+    return false;
+  }
+  capture->file_bytes = ftell(capture->file);
+  if (capture->file_bytes <= 0) {
+    capture->file_bytes =
+        fwrite(capture_magic, 1, sizeof(capture_magic), capture->file);
+    fflush(capture->file);
+  }
+  return true;
+}
+
+static void rotate_capture_file(Capture *capture) {
+  fclose(capture->file);
+  char from[1040];
+  char to[1040];
+  for (int i = CAPTURE_FILES - 1; i >= 1; i--) {
+    if (i == 1) {
+      snprintf(from, sizeof(from), "%s", capture->path);
+    } else {
+      snprintf(from, sizeof(from), "%s.%d", capture->path, i - 1);
+    }
+    snprintf(to, sizeof(to), "%s.%d", capture->path, i);
+    rename(from, to);
+  }
+  open_capture_file(capture, false);
+}
+
+/**
+ * Writes the records of the buffer that weren't written yet, up to `count`.
+ * Records that can't be written are counted as dropped.
+ */
+static void write_capture_buffer(Capture *capture, CaptureBuffer *buffer,
+                                 int count) {
+  long size = (long)(count - buffer->flushed) * CAPTURE_RECORD_SIZE;
+  if (size <= 0) {
+    return;
+  }
+
+  // If the file couldn't be reopened last time, maybe it can now.
+  if (capture->file == NULL) {
+    open_capture_file(capture, true);
+  } else if (capture->file_bytes + size > capture->max_file_bytes) {
+    rotate_capture_file(capture);
+  }
+
+  long written = 0;
+  if (capture->file != NULL) {
+    unsigned char *bytes =
+        &buffer->bytes[buffer->flushed * CAPTURE_RECORD_SIZE];
+    written = fwrite(bytes, 1, size, capture->file);
+    fflush(capture->file);
+    capture->file_bytes += written;
+  }
+  if (written < size) {
+    atomic_fetch_add(&capture->dropped,
+                     (size - written) / CAPTURE_RECORD_SIZE);
+  }
+  buffer->flushed = count;
+}
+
+/**
+ * Writes what the buffers being filled hold so far, the caller must not be
+ * holding the lock.
+ */
+static void write_filling_buffers(Capture *capture) {
+  for (int slot = 0; slot < MAX_FLIGHT_RECORDERS; slot++) {
+    CaptureBuffer *buffer = atomic_load(&capture->filling[slot]);
+    if (buffer != NULL) {
+      write_capture_buffer(capture, buffer, atomic_load(&buffer->count));
+    }
+  }
+}
+
+static void *run_capture_writer(void *argument) {
+  Capture *capture = (Capture *)argument;
+  uint64_t flushed_at = wall_clock();
+  pthread_mutex_lock(&capture->lock);
+  while (true) {
+    while (capture->full_first == NULL && !capture->stopping &&
+           wall_clock() - flushed_at < CAPTURE_MAX_DELAY) {
+      uint64_t deadline = flushed_at + CAPTURE_MAX_DELAY;
+      struct timespec until = {.tv_sec = deadline / 1000000000,
+                               .tv_nsec = deadline % 1000000000};
+      pthread_cond_timedwait(&capture->work, &capture->lock, &until);
+    }
+
+    CaptureBuffer *buffer = capture->full_first;
+    if (buffer == NULL && capture->stopping) {
+      break;
+    } else if (buffer == NULL) {
+      pthread_mutex_unlock(&capture->lock);
+      write_filling_buffers(capture);
+      flushed_at = wall_clock();
+      pthread_mutex_lock(&capture->lock);
+      continue;
+    }
+    capture->full_first = buffer->next;
+    if (capture->full_first == NULL) {
+      capture->full_last = NULL;
+    }
+    pthread_mutex_unlock(&capture->lock);
+
+    write_capture_buffer(capture, buffer, atomic_load(&buffer->count));
+
+    pthread_mutex_lock(&capture->lock);
+    atomic_store(&buffer->count, 0);
+    buffer->flushed = 0;
+    buffer->next = capture->free_buffers;
+    capture->free_buffers = buffer;
+  }
+  pthread_mutex_unlock(&capture->lock);
+  return NULL;
+}
+
+/**
+ * Starts capturing all solves to the file at `path`, rotating it once it
+ * grows past `max_file_bytes`. If `append` is set solves are added to what's
+ * already in the file, otherwise it starts out empty. Returns `false` if
+ * capturing couldn't start.
+ */
+static bool start_capture(const char *path, long max_file_bytes,
+                          bool append) {
+  Capture *started = (Capture *)star_calloc(1, sizeof(Capture));
+  if (started == NULL) {
+    return false;
+  }
+
+  snprintf(started->path, sizeof(started->path), "%s", path);
+  started->max_file_bytes = max_file_bytes;
+  for (int i = 0; i < CAPTURE_BUFFERS; i++) {
+    started->buffers[i].next = started->free_buffers;
+    started->free_buffers = &started->buffers[i];
+  }
+  pthread_mutex_init(&started->lock, NULL);
+  pthread_cond_init(&started->work, NULL);
+
+  if (!open_capture_file(started, append)) {
+    free(started);
+    return false;
+  } else if (pthread_create(&started->writer, NULL, run_capture_writer,
+                            started) != 0) {
+    fclose(started->file);
+    free(started);
+    return false;
+  }
+
+  capture = started;
+  return true;
+}
+
+/** Queues a buffer for writing, the caller must be holding the lock. */
+static void hand_over_buffer(Capture *capture, CaptureBuffer *buffer) {
+  buffer->next = NULL;
+  if (capture->full_last == NULL) {
+    capture->full_first = buffer;
+  } else {
+    capture->full_last->next = buffer;
+  }
+  capture->full_last = buffer;
+  pthread_cond_signal(&capture->work);
+}
+
+/**
+ * Writes out everything that was captured and stops capturing.
+ * Returns the number of solves that had to be dropped.
+ */
+static long stop_capture() {
+  if (capture == NULL) {
+    return 0;
+  }
+
+  Capture *stopped = capture;
+  capture = NULL;
+  pthread_mutex_lock(&stopped->lock);
+  for (int slot = 0; slot < MAX_FLIGHT_RECORDERS; slot++) {
+    CaptureBuffer *buffer = atomic_load(&stopped->filling[slot]);
+    if (buffer != NULL) {
+      hand_over_buffer(stopped, buffer);
+    }
+  }
+  stopped->stopping = true;
+  pthread_cond_signal(&stopped->work);
+  pthread_mutex_unlock(&stopped->lock);
+
+  pthread_join(stopped->writer, NULL);
+  if (stopped->file != NULL) {
+    fclose(stopped->file);
+  }
+  pthread_mutex_destroy(&stopped->lock);
+  pthread_cond_destroy(&stopped->work);
+  long dropped = atomic_load(&stopped->dropped);
+  free(stopped);
+  return dropped;
+}
+
+static void capture_solve(Engine engine, Grid grid, uint64_t latency) {
+  if (capture == NULL) {
+    return;
+  } else if (flight_recorder_slot == -1) {
+    atomic_fetch_add(&capture->dropped, 1);
+    return;
+  }
+
+  CaptureBuffer *buffer = atomic_load_explicit(
+      &capture->filling[flight_recorder_slot], memory_order_relaxed);
+  if (buffer == NULL) {
+    pthread_mutex_lock(&capture->lock);
+    buffer = capture->free_buffers;
+    if (buffer != NULL) {
+      capture->free_buffers = buffer->next;
+    }
+    pthread_mutex_unlock(&capture->lock);
+    if (buffer == NULL) {
+      atomic_fetch_add(&capture->dropped, 1);
+      return;
+    }
+    atomic_store_explicit(&capture->filling[flight_recorder_slot], buffer,
+                          memory_order_release);
+  }
+
+  int count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+  unsigned char *record = &buffer->bytes[count * CAPTURE_RECORD_SIZE];
+  put_little_endian(record, wall_clock(), 8);
+  // Solves taking longer than 4 seconds don't fit, they're saturated.
+  put_little_endian(record + 8, latency < UINT32_MAX ? latency : UINT32_MAX,
+                    4);
+  put_little_endian(record + 12, rule_set, 2);
+  put_little_endian(record + 14, grid, 2);
+  record[16] = engine;
+  record[17] = 0;
+
+  // Publishes the record to the writer.
+  atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+  if (count + 1 == CAPTURE_RECORDS) {
+    atomic_store_explicit(&capture->filling[flight_recorder_slot], NULL,
+                          memory_order_relaxed);
+    pthread_mutex_lock(&capture->lock);
+    hand_over_buffer(capture, buffer);
+    pthread_mutex_unlock(&capture->lock);
+  }
+}
+
+/**
+ * Records a solve that started at `started_at` (as returned by `now`) and just
+ * finished, together with the `solve_stats` the engine left behind, in the
+ * flight recorder and in the capture if it's on.
+ */
+static void record_solve(Engine engine, Grid grid, uint64_t started_at) {
+  if (flight_recorder_slot == -1) {
+    claim_flight_recorder();
+  }
+
+  if (flight_recorder_slot != -1) {
+    FlightRecorder *recorder = &flight_recorders[flight_recorder_slot];
+    uint64_t finished_at = now();
+    SolveRecord record = {.finished_at = finished_at,
+                          .duration = finished_at - started_at,
+                          .nodes = solve_stats.nodes,
+                          .frontier_peak = solve_stats.frontier_peak,
+                          .grid = grid,
+                          .engine = engine};
+
+    write_record(&recorder->recent_written, recorder->recent, RECENT_SOLVES,
+                 &record);
+    if (record.duration > slow_solve_threshold) {
+      write_record(&recorder->slow_written, recorder->slow, SLOW_SOLVES,
+                   &record);
+    }
+    capture_solve(engine, grid, record.duration);
+  } else {
+    // Without a recorder there's no buffer to capture the solve in.
+    capture_solve(engine, grid, now() - started_at);
+  }
+
+  if (flight_recorder_dump_requested) {
+    flight_recorder_dump_requested = 0;
+    dump_flight_recorders(stderr);
+  }
+}
+
+/** WORKER POOL ***************************************************************
+ * Solving a big batch of grids is split among a pool of worker threads, one
+ * for each core we're allowed to run on, each pinned to its own core so it
+ * keeps its caches warm.
+ *
+ * Using all of them is not always the fastest option: when each task is tiny,
+ * more workers just means more contention. So the batch is processed in
+ * rounds and only the first `active_workers` take part in each one. After each
+ * round we look at the throughput and keep moving the number of active workers
+ * in the same direction while it gets better, turning around when it gets
+ * worse.
+ *
+ * Workers take the index of their next task from a shared atomic counter, so
+ * there's no need to split the work up front.
+ */
+
+#define MAX_WORKERS 64
+
+typedef void (*Task)(void *context, int worker, int index);
+
+// What each worker thread is started with.
+typedef struct Worker {
+  struct WorkerPool *pool;
+  int id;
+} Worker;
+
+typedef struct WorkerPool {
+  pthread_t threads[MAX_WORKERS];
+  Worker worker_ids[MAX_WORKERS];
+  int workers;
+  int active_workers;
+  // Hill climbing state: +1 or -1, and the throughput of the last round in
+  // tasks per second.
+  int direction;
+  double last_throughput;
+
+  pthread_mutex_t lock;
+  pthread_cond_t round_started;
+  pthread_cond_t round_finished;
+  int round;
+  int finished_workers;
+  bool stopping;
+
+  // The current round: tasks go from `next` up to `end` excluded.
+  Task task;
+  void *context;
+  atomic_int next;
+  int end;
+  // How many tasks each worker completed overall.
+  long completed[MAX_WORKERS];
+} WorkerPool;
+
+/**
+ * Pins the calling thread to the `n`-th core among those the process is
+ * allowed to run on. This is only supported on Linux, anywhere else threads
+ * are left wherever the scheduler puts them.
+ */
+static void pin_to_core(int n) {
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &allowed) && n-- == 0) {
+      cpu_set_t pinned;
+      CPU_ZERO(&pinned);
+      CPU_SET(cpu, &pinned);
+      pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned);
+      return;
+    }
+  }
+#else
+  (void)n;
+#endif
+}
+
+static int available_cores() {
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    return CPU_COUNT(&allowed);
+  }
+#endif
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? cores : 1;
+}
+
+static void *run_worker(void *argument) {
+  Worker *worker = (Worker *)argument;
+  WorkerPool *pool = worker->pool;
+  int seen_round = 0;
+  pin_to_core(worker->id);
+
+  while (true) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stopping &&
+           (pool->round == seen_round || worker->id >= pool->active_workers)) {
+      seen_round = pool->round;
+      pthread_cond_wait(&pool->round_started, &pool->lock);
+    }
+    if (pool->stopping) {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+    seen_round = pool->round;
+    pthread_mutex_unlock(&pool->lock);
+
+    long completed = 0;
+    int index;
+    while ((index = atomic_fetch_add(&pool->next, 1)) < pool->end) {
+      pool->task(pool->context, worker->id, index);
+      completed++;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->completed[worker->id] += completed;
+    if (++pool->finished_workers == pool->active_workers) {
+      pthread_cond_signal(&pool->round_finished);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/**
+ * Starts a pool with a worker for each available core, all of them are active
+ * at first. Returns `NULL` if the pool couldn't be started.
+ */
+static WorkerPool *new_worker_pool() {
+  WorkerPool *pool = (WorkerPool *)star_calloc(1, sizeof(WorkerPool));
+  if (pool == NULL) {
+    return NULL;
+  }
+
+  int cores = available_cores();
+  pool->workers = cores < MAX_WORKERS ? cores : MAX_WORKERS;
+  pool->active_workers = pool->workers;
+  pool->direction = -1;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->round_started, NULL);
+  pthread_cond_init(&pool->round_finished, NULL);
+
+  for (int i = 0; i < pool->workers; i++) {
+    pool->worker_ids[i].pool = pool;
+    pool->worker_ids[i].id = i;
+    if (pthread_create(&pool->threads[i], NULL, run_worker,
+                       &pool->worker_ids[i]) != 0) {
+      // We'll make do with the workers we managed to start.
+      pool->workers = i;
+      pool->active_workers = i;
+      break;
+    }
+  }
+
+  if (pool->workers == 0) {
+    free(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+static void free_worker_pool(WorkerPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->round_started);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->workers; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->round_started);
+  pthread_cond_destroy(&pool->round_finished);
+  free(pool);
+}
+
+/**
+ * Runs the tasks from `start` up to `end` excluded on the active workers and
+ * waits for all of them to be done.
+ */
+static void run_round(WorkerPool *pool, Task task, void *context, int start,
+                      int end) {
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->context = context;
+  atomic_store(&pool->next, start);
+  pool->end = end;
+  pool->finished_workers = 0;
+  pool->round++;
+  pthread_cond_broadcast(&pool->round_started);
+  while (pool->finished_workers < pool->active_workers) {
+    pthread_cond_wait(&pool->round_finished, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Runs `count` tasks in rounds of `round_size`, adjusting the number of
+ * active workers after each round. If `report` is not `NULL` a line is
+ * written there for each round.
+ */
+static void run_adaptive(WorkerPool *pool, Task task, void *context,
+                         int count, int round_size, FILE *report) {
+  for (int start = 0; start < count; start += round_size) {
+    int end = start + round_size < count ? start + round_size : count;
+    uint64_t started_at = now();
+    run_round(pool, task, context, start, end);
+    double seconds = (now() - started_at) / 1e9;
+    double throughput = (end - start) / (seconds > 0 ? seconds : 1e-9);
+
+    if (report != NULL) {
+      fprintf(report, "%d\t%d\t%.0f\n", start / round_size,
+              pool->active_workers, throughput);
+    }
+
+    // A round worse than the one before means we moved in the wrong
+    // direction, so we turn around.
+    if (throughput < pool->last_throughput) {
+      pool->direction = -pool->direction;
+    }
+    pool->last_throughput = throughput;
+
+    int active_workers = pool->active_workers + pool->direction;
+    if (active_workers < 1 || active_workers > pool->workers) {
+      pool->direction = -pool->direction;
+      active_workers = pool->active_workers;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->active_workers = active_workers;
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/** ANY-TO-ANY ORACLE *********************************************************
+ * Sometimes we want the shortest way to get from one grid to another, not
+ * necessarily to the winning grid. Here we follow the bare move graph: the
+ * winning grid is just a grid like any other.
+ *
+ * There are two ways to answer these queries:
+ * - a distance matrix with the distance between every pair of grids, built
+ *   with a bfs from each grid. The bfs are independent so they're split among
+ *   the worker pool. Then any path is found by always moving to a grid that's
+ *   one step closer to the target;
+ * - landmarks: a handful of grids with their distance to and from every other
+ *   grid. By the triangle inequality, `d(v, t) >= d(l, t) - d(l, v)` and
+ *   `d(v, t) >= d(v, l) - d(t, l)` for any landmark `l`, which gives A* a lower
+ *   bound to work with. This takes much less memory and the number of
+ *   landmarks trades memory for tighter bounds.
+ */
+
+#define MAX_LANDMARKS 16
+
+// The distance between two grids when there's no way to get from one to the
+// other.
+static const unsigned char unreachable = 0xFF;
+
+typedef struct DistanceMatrix {
+  MoveGraph *graph;
+  // `distances[a][b]` is the number of moves needed to go from `a` to `b`.
+  unsigned char distances[512][512];
+} DistanceMatrix;
+
+typedef struct Landmarks {
+  MoveGraph *graph;
+  int count;
+  Grid grids[MAX_LANDMARKS];
+  // The distance from each landmark to every grid and from every grid to each
+  // landmark.
+  unsigned char from[MAX_LANDMARKS][512];
+  unsigned char to[MAX_LANDMARKS][512];
+} Landmarks;
+
+/**
+ * Computes the distance from `source` to every grid, or from every grid to
+ * `source` if `reverse` is `true`.
+ */
+static void graph_distances(MoveGraph *graph, Grid source, bool reverse,
+                            unsigned char distances[512]) {
+  uint16_t *offsets = reverse ? graph->reverse_offsets : graph->forward_offsets;
+  uint16_t *grids = reverse ? graph->reverse_sources : graph->forward_targets;
+  Grid queue[512];
+  int first = 0;
+  int last = 0;
+
+  memset(distances, unreachable, 512);
+  distances[source] = 0;
+  queue[last++] = source;
+  while (first < last) {
+    Grid grid = queue[first++];
+    for (int e = offsets[grid]; e < offsets[grid + 1]; e++) {
+      if (distances[grids[e]] == unreachable) {
+        distances[grids[e]] = distances[grid] + 1;
+        queue[last++] = grids[e];
+      }
+    }
+  }
+}
+
+static void fill_matrix_row(void *context, int worker, int source) {
+  (void)worker;
+  DistanceMatrix *matrix = (DistanceMatrix *)context;
+  graph_distances(matrix->graph, source, false, matrix->distances[source]);
+}
+
+/**
+ * Builds the full distance matrix using the workers of the pool, or on the
+ * calling thread if there's no pool.
+ */
+static DistanceMatrix *new_distance_matrix(MoveGraph *graph,
+                                           WorkerPool *pool) {
+  DistanceMatrix *matrix =
+      (DistanceMatrix *)star_malloc(sizeof(DistanceMatrix));
+  if (matrix == NULL) {
+    return NULL;
+  }
+
+  matrix->graph = graph;
+  if (pool != NULL) {
+    run_round(pool, fill_matrix_row, matrix, 0, 512);
+  } else {
+    for (int source = 0; source < 512; source++) {
+      fill_matrix_row(matrix, 0, source);
+    }
+  }
+  return matrix;
+}
+
+/**
+ * Writes in `moves` the shortest sequence of moves going from `from` to `to`.
+ * Returns the number of moves, or -1 if there's none.
+ */
+static int matrix_moves(DistanceMatrix *matrix, Grid from, Grid to,
+                        int moves[511]) {
+  MoveGraph *graph = matrix->graph;
+  int length = matrix->distances[from][to];
+  if (length == unreachable) {
+    return -1;
+  }
+
+  for (int m = 0; m < length; m++) {
+    for (int e = graph->forward_offsets[from];
+         e < graph->forward_offsets[from + 1]; e++) {
+      Grid next = graph->forward_targets[e];
+      if (matrix->distances[next][to] == length - m - 1) {
+        moves[m] = graph->forward_moves[e];
+        from = next;
+        break;
+      }
+    }
+  }
+  return length;
+}
+
+/**
+ * Picks `count` landmarks: the first one is the winning grid, each of the
+ * following ones is the grid farthest away from all the landmarks picked so
+ * far, so that they end up spread all over the graph.
+ */
+static Landmarks *new_landmarks(MoveGraph *graph, int count) {
+  Landmarks *landmarks = (Landmarks *)star_malloc(sizeof(Landmarks));
+  if (landmarks == NULL) {
+    return NULL;
+  }
+
+  landmarks->graph = graph;
+  landmarks->count = count < MAX_LANDMARKS ? count : MAX_LANDMARKS;
+  Grid landmark = winning_grid;
+  for (int l = 0; l < landmarks->count; l++) {
+    landmarks->grids[l] = landmark;
+    graph_distances(graph, landmark, false, landmarks->from[l]);
+    graph_distances(graph, landmark, true, landmarks->to[l]);
+
+    int farthest = -1;
+    for (int grid = 0; grid < 512; grid++) {
+      int closest = unreachable;
+      for (int other = 0; other <= l; other++) {
+        if (landmarks->from[other][grid] < closest) {
+          closest = landmarks->from[other][grid];
+        }
+      }
+      if (closest != unreachable && closest > farthest) {
+        farthest = closest;
+        landmark = grid;
+      }
+    }
+  }
+  return landmarks;
+}
+
+/**
+ * A lower bound on the number of moves needed to go from `grid` to `target`.
+ */
+static int landmark_bound(Landmarks *landmarks, Grid grid, Grid target) {
+  int bound = 0;
+  for (int l = 0; l < landmarks->count; l++) {
+    unsigned char *from = landmarks->from[l];
+    unsigned char *to = landmarks->to[l];
+    if (from[grid] != unreachable && from[target] != unreachable &&
+        from[target] - from[grid] > bound) {
+      bound = from[target] - from[grid];
+    }
+    if (to[grid] != unreachable && to[target] != unreachable &&
+        to[grid] - to[target] > bound) {
+      bound = to[grid] - to[target];
+    }
+  }
+  return bound;
+}
+
+typedef struct HeapEntry {
+  int estimate;
+  Grid grid;
+} HeapEntry;
+
+static void push_heap(HeapEntry *heap, int *size, HeapEntry entry) {
+  int i = (*size)++;
+  heap[i] = entry;
+  while (i > 0 && heap[(i - 1) / 2].estimate > heap[i].estimate) {
+    HeapEntry swap = heap[i];
+    heap[i] = heap[(i - 1) / 2];
+    heap[(i - 1) / 2] = swap;
+    i = (i - 1) / 2;
+  }
+}
+
+static HeapEntry pop_heap(HeapEntry *heap, int *size) {
+  HeapEntry top = heap[0];
+  heap[0] = heap[--*size];
+  for (int i = 0; 2 * i + 1 < *size;) {
+    int child = 2 * i + 1;
+    if (child + 1 < *size && heap[child + 1].estimate < heap[child].estimate) {
+      child++;
+    }
+    if (heap[i].estimate <= heap[child].estimate) {
+      break;
+    }
+    HeapEntry swap = heap[i];
+    heap[i] = heap[child];
+    heap[child] = swap;
+    i = child;
+  }
+  return top;
+}
+
+/**
+ * Finds the shortest sequence of moves from `from` to `to` with A*, using the
+ * landmarks for the lower bounds. The open set is a binary heap ordered by
+ * the estimated length of the whole path; instead of updating a grid already
+ * in the heap we push it again and skip the stale entry when it comes out.
+ * Returns the number of moves, or -1 if there's none.
+ */
+static int landmark_moves(Landmarks *landmarks, Grid from, Grid to,
+                          int moves[511]) {
+  MoveGraph *graph = landmarks->graph;
+  // Each grid enters the heap at most once for each of its incoming edges.
+  HeapEntry heap[512 * 9 + 1];
+  int heap_size = 0;
+  unsigned char distance[512];
+  Grid parent[512];
+  unsigned char move[512];
+  bool closed[512] = {false};
+  memset(distance, unreachable, sizeof(distance));
+  reset_solve_stats();
+
+  distance[from] = 0;
+  push_heap(heap, &heap_size,
+            (HeapEntry){landmark_bound(landmarks, from, to), from});
+
+  while (heap_size > 0) {
+    record_frontier(heap_size);
+    Grid grid = pop_heap(heap, &heap_size).grid;
+    if (closed[grid]) {
+      continue;
+    }
+    closed[grid] = true;
+    solve_stats.nodes++;
+    if (grid == to) {
+      break;
+    }
+
+    for (int e = graph->forward_offsets[grid];
+         e < graph->forward_offsets[grid + 1]; e++) {
+      Grid next = graph->forward_targets[e];
+      if (closed[next] || (distance[next] != unreachable &&
+                           distance[next] <= distance[grid] + 1)) {
+        continue;
+      }
+
+      distance[next] = distance[grid] + 1;
+      parent[next] = grid;
+      move[next] = graph->forward_moves[e];
+      int estimate = distance[next] + landmark_bound(landmarks, next, to);
+      push_heap(heap, &heap_size, (HeapEntry){estimate, next});
+    }
+  }
+
+  if (!closed[to]) {
+    return -1;
+  }
+  int length = distance[to];
+  for (int m = length - 1; m >= 0; m--) {
+    moves[m] = move[to];
+    to = parent[to];
+  }
+  return length;
+}
+
+/** SHARDING BY COSETS ********************************************************
+ * Forgetting about stars, a move xors its mask into the grid, so every grid
+ * reachable from `grid` is `grid` plus some combination of masks: it's in the
+ * same coset of the subspace spanned by the move masks. Grouping grids by
+ * coset gives shards that never have to look at each other: a query is routed
+ * to a single shard, and each shard can be built on its own.
+ *
+ * Within the span, each grid is identified by the pivots (basis masks with
+ * distinct leading bits) used to reduce it, and each coset by what's left
+ * after the reduction, which only has bits that lead no pivot.
+ *
+ * On the 3x3 board the masks span the whole space, so there's a single coset
+ * holding all 512 grids. Larger boards, where they don't, get one shard for
+ * each coset.
+ */
+
+typedef struct CosetPartition {
+  // Indexed by leading bit, `empty_grid` where there's no pivot.
+  Grid pivots[16];
+  // Bits that lead a pivot, and all the others.
+  Grid pivot_bits;
+  Grid free_bits;
+  int rank;
+  int cosets;
+} CosetPartition;
+
+typedef struct Shard {
+  // Indexed by position within the coset, see `reduce_grid`.
+  unsigned char *distance;
+  unsigned char *next_move;
+} Shard;
+
+typedef struct ShardedTables {
+  CosetPartition partition;
+  int grids_per_shard;
+  Shard *shards;
+} ShardedTables;
+
+static const char shard_magic[8] = {'S', 'T', 'A', 'R', 'S', 'H', 'D', '2'};
+
+// After the magic, all little endian: the rank as a u16, the coset as a u32
+// and the 16 pivots of the partition as u16s. The distances and the next
+// moves of the shard come last.
+#define SHARD_HEADER_BYTES (2 + 4 + 16 * 2)
+
+/** Packs the bits of `value` selected by `mask` into the lowest bits. */
+static int compress_bits(Grid value, Grid mask) {
+  int packed = 0;
+  for (int bit = 0, position = 0; bit < 16; bit++) {
+    if (mask & (1 << bit)) {
+      packed |= ((value >> bit) & 1) << position++;
+    }
+  }
+  return packed;
+}
+
+/** The opposite of `compress_bits`. */
+static Grid expand_bits(int packed, Grid mask) {
+  Grid value = empty_grid;
+  for (int bit = 0, position = 0; bit < 16; bit++) {
+    if (mask & (1 << bit)) {
+      value |= ((packed >> position++) & 1) << bit;
+    }
+  }
+  return value;
+}
+
+static void new_coset_partition(CosetPartition *partition) {
+  memset(partition, 0, sizeof(CosetPartition));
+  for (int cell = 1; cell <= 9; cell++) {
+    Grid mask = move_mask(cell);
+    for (int bit = 15; bit >= 0 && mask != empty_grid; bit--) {
+      if (!(mask & (1 << bit))) {
+        continue;
+      } else if (partition->pivots[bit] == empty_grid) {
+        partition->pivots[bit] = mask;
+        partition->pivot_bits |= 1 << bit;
+        partition->rank++;
+        break;
+      }
+      mask ^= partition->pivots[bit];
+    }
+  }
+  partition->free_bits = full_grid & ~partition->pivot_bits;
+  partition->cosets = 1 << (9 - partition->rank);
+}
+
+/**
+ * Reduces a grid by the pivots, returning its coset and setting `position` to
+ * its position within the coset.
+ */
+static int reduce_grid(CosetPartition *partition, Grid grid, int *position) {
+  Grid used_pivots = empty_grid;
+  for (int bit = 15; bit >= 0; bit--) {
+    if (grid & partition->pivot_bits & (1 << bit)) {
+      grid ^= partition->pivots[bit];
+      used_pivots |= 1 << bit;
+    }
+  }
+  *position = compress_bits(used_pivots, partition->pivot_bits);
+  return compress_bits(grid, partition->free_bits);
+}
+
+/** The opposite of `reduce_grid`. */
+static Grid grid_in_coset(CosetPartition *partition, int coset, int position) {
+  Grid grid = expand_bits(coset, partition->free_bits);
+  Grid used_pivots = expand_bits(position, partition->pivot_bits);
+  for (int bit = 15; bit >= 0; bit--) {
+    if (used_pivots & (1 << bit)) {
+      grid ^= partition->pivots[bit];
+    }
+  }
+  return grid;
+}
+
+/**
+ * Fills a shard with a bfs going backwards from the winning grid, if it's in
+ * this coset at all: otherwise nothing in the shard can ever be won.
+ */
+static void build_shard(void *context, int worker, int coset) {
+  (void)worker;
+  ShardedTables *tables = (ShardedTables *)context;
+  CosetPartition *partition = &tables->partition;
+  Shard *shard = &tables->shards[coset];
+  int grids = tables->grids_per_shard;
+  shard->distance = (unsigned char *)star_malloc(grids);
+  shard->next_move = (unsigned char *)star_malloc(grids);
+  int *queue = (int *)star_malloc(sizeof(int) * grids);
+  if (shard->distance == NULL || shard->next_move == NULL || queue == NULL) {
+    free(shard->distance);
+    free(shard->next_move);
+    free(queue);
+    shard->distance = NULL;
+    shard->next_move = NULL;
+    return;
+  }
+  memset(shard->distance, dead_distance, grids);
+  memset(shard->next_move, 0, grids);
+
+  int winning_position;
+  int head = 0, tail = 0;
+  if (reduce_grid(partition, winning_grid, &winning_position) == coset) {
+    shard->distance[winning_position] = 0;
+    queue[tail++] = winning_position;
+  }
+  while (head < tail) {
+    int position = queue[head++];
+    Grid grid = grid_in_coset(partition, coset, position);
+    for (int cell = 1; cell <= 9; cell++) {
+      Grid previous = grid ^ move_mask(cell);
+      int previous_position;
+      reduce_grid(partition, previous, &previous_position);
+      if (is_star(previous, cell) &&
+          shard->distance[previous_position] == dead_distance) {
+        shard->distance[previous_position] = shard->distance[position] + 1;
+        shard->next_move[previous_position] = cell;
+        queue[tail++] = previous_position;
+      }
+    }
+  }
+  free(queue);
+}
+
+static void free_sharded_tables(ShardedTables *tables) {
+  for (int coset = 0; coset < tables->partition.cosets; coset++) {
+    free(tables->shards[coset].distance);
+    free(tables->shards[coset].next_move);
+  }
+  free(tables->shards);
+  free(tables);
+}
+
+/**
+ * Builds all the shards, in parallel if a pool is given. Returns `NULL` if
+ * there's not enough memory.
+ */
+static ShardedTables *new_sharded_tables(WorkerPool *pool) {
+  ShardedTables *tables =
+      (ShardedTables *)star_calloc(1, sizeof(ShardedTables));
+  if (tables == NULL) {
+    return NULL;
+  }
+  new_coset_partition(&tables->partition);
+  tables->grids_per_shard = 1 << tables->partition.rank;
+  tables->shards =
+      (Shard *)star_calloc(tables->partition.cosets, sizeof(Shard));
+  if (tables->shards == NULL) {
+    free(tables);
+    return NULL;
+  }
+
+  if (pool != NULL) {
+    run_round(pool, build_shard, tables, 0, tables->partition.cosets);
+  } else {
+    for (int coset = 0; coset < tables->partition.cosets; coset++) {
+      build_shard(tables, 0, coset);
+    }
+  }
+  for (int coset = 0; coset < tables->partition.cosets; coset++) {
+    if (tables->shards[coset].distance == NULL) {
+      free_sharded_tables(tables);
+      return NULL;
+    }
+  }
+  return tables;
+}
+
+/**
+ * Same as `shortest_winning_moves`, looking only at the shard of the coset
+ * `grid` is in.
+ */
+static int sharded_winning_moves(ShardedTables *tables, Grid grid,
+                                 int moves[511]) {
+  int position;
+  Shard *shard =
+      &tables->shards[reduce_grid(&tables->partition, grid, &position)];
+  if (shard->distance[position] == dead_distance) {
+    return -1;
+  }
+
+  int length = 0;
+  while (shard->distance[position] > 0) {
+    moves[length] = shard->next_move[position];
+    grid = explode(grid, moves[length++]);
+    reduce_grid(&tables->partition, grid, &position);
+  }
+  return length;
+}
+
+static void encode_shard_header(CosetPartition *partition, int coset,
+                                unsigned char header[SHARD_HEADER_BYTES]) {
+  put_little_endian(header, partition->rank, 2);
+  put_little_endian(header + 2, coset, 4);
+  for (int bit = 0; bit < 16; bit++) {
+    put_little_endian(header + 6 + 2 * bit, partition->pivots[bit], 2);
+  }
+}
+
+/**
+ * Checks that a shard read from a file is consistent: the winning grid is at
+ * distance 0 if it's in the coset, and the next move of every other grid that
+ * can be won explodes one of its stars and gets one move closer.
+ */
+static bool valid_shard(ShardedTables *tables, int coset,
+                        unsigned char *distance, unsigned char *next_move) {
+  CosetPartition *partition = &tables->partition;
+  for (int position = 0; position < tables->grids_per_shard; position++) {
+    Grid grid = grid_in_coset(partition, coset, position);
+    if (distance[position] == dead_distance) {
+      continue;
+    } else if ((distance[position] == 0) != (grid == winning_grid)) {
+      return false;
+    } else if (distance[position] == 0) {
+      continue;
+    }
+
+    int move = next_move[position];
+    if (move < 1 || move > 9 || !is_star(grid, move)) {
+      return false;
+    }
+    int next_position;
+    reduce_grid(partition, explode(grid, move), &next_position);
+    if (distance[next_position] != distance[position] - 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Writes a shard to the given file, so that it can be served on its own.
+ * Returns `false` if anything goes wrong.
+ */
+static bool save_shard(ShardedTables *tables, int coset, const char *file) {
+  FILE *out = fopen(file, "wb");
+  if (out == NULL) {
+    return false;
+  }
+
+  Shard *shard = &tables->shards[coset];
+  unsigned char header[SHARD_HEADER_BYTES];
+  encode_shard_header(&tables->partition, coset, header);
+  int grids = tables->grids_per_shard;
+  bool written =
+      fwrite(shard_magic, sizeof(shard_magic), 1, out) == 1 &&
+      fwrite(header, sizeof(header), 1, out) == 1 &&
+      fwrite(shard->distance, grids, 1, out) == 1 &&
+      fwrite(shard->next_move, grids, 1, out) == 1;
+  return fclose(out) == 0 && written;
+}
+
+/**
+ * Reads back the shard for `coset` written by `save_shard`, in place of the
+ * one in the tables. Returns `false`, leaving the tables as they were, if the
+ * file is missing, it's not the shard of the same coset of the same partition
+ * or it's not consistent.
+ */
+static bool load_shard(ShardedTables *tables, int coset, const char *file) {
+  FILE *in = fopen(file, "rb");
+  if (in == NULL) {
+    return false;
+  }
+
+  int grids = tables->grids_per_shard;
+  unsigned char *distance = (unsigned char *)star_malloc(grids);
+  unsigned char *next_move = (unsigned char *)star_malloc(grids);
+  char magic[sizeof(shard_magic)];
+  unsigned char header[SHARD_HEADER_BYTES];
+  unsigned char expected_header[SHARD_HEADER_BYTES];
+  encode_shard_header(&tables->partition, coset, expected_header);
+  bool loaded =
+      distance != NULL && next_move != NULL &&
+      fread(magic, sizeof(magic), 1, in) == 1 &&
+      memcmp(magic, shard_magic, sizeof(magic)) == 0 &&
+      fread(header, sizeof(header), 1, in) == 1 &&
+      memcmp(header, expected_header, sizeof(header)) == 0 &&
+      fread(distance, grids, 1, in) == 1 &&
+      fread(next_move, grids, 1, in) == 1 &&
+      valid_shard(tables, coset, distance, next_move);
+  fclose(in);
+
+  if (loaded) {
+    Shard *shard = &tables->shards[coset];
+    memcpy(shard->distance, distance, grids);
+    memcpy(shard->next_move, next_move, grids);
+  }
+  free(distance);
+  free(next_move);
+  return loaded;
+}
+
+/** HOT SWAPPING TABLES *******************************************************
+ * Tables can be replaced while queries are running, without stopping or
+ * slowing down any of them.
+ *
+ * Readers never take a lock: they announce the epoch they started in, use
+ * whatever tables are published and then announce they're done. Publishing
+ * new tables swaps a single pointer and then waits for every reader that could
+ * still be looking at the old ones (that is, every reader that started before
+ * the swap) before freeing them.
+ *
+ * Each reading thread claims a slot for its epoch the first time it reads,
+ * and gives it back when it exits. There are slots for a full worker pool and
+ * then some, a thread that can't get one answers with a plain search and
+ * that's reported once on stderr.
+ *
+ * When the process is restarted, the tables it was serving can be handed over
+ * to the new process through a memory file that survives `exec`, so that the
+ * new process never has to rebuild them.
+ */
+
+// A multiple of 64, there's a bit for each slot in `readers_claimed`.
+#define MAX_READERS (2 * 64)
+
+// The tables for a set of rules, swapped together as a whole.
+typedef struct ServedTables {
+  uint16_t rule_set;
+  SolutionTable table;
+} ServedTables;
+
+static _Atomic(ServedTables *) served_tables = NULL;
+// Epochs start from 1, a reader in epoch 0 is not reading at all.
+static atomic_uint_fast64_t serving_epoch = 1;
+static atomic_uint_fast64_t reader_epochs[MAX_READERS];
+static atomic_uint_least64_t readers_claimed[MAX_READERS / 64];
+static _Thread_local int reader_slot = -1;
+static pthread_key_t reader_key;
+static pthread_once_t reader_key_once = PTHREAD_ONCE_INIT;
+static atomic_bool readers_ran_out = false;
+
+static const char warm_tables_magic[8] = {'S', 'T', 'A', 'R',
+                                          'W', 'R', 'M', '2'};
+
+// After the magic: the rule set as a u16, the size of the table as a u32 and
+// a u64 checksum of the table, which comes last.
+#define WARM_HEADER_BYTES (2 + 4 + 8)
+
+/**
+ * Returns complete tables for the given rules, or `NULL` if there's not
+ * enough memory.
+ */
+static ServedTables *new_served_tables(uint16_t rule_set) {
+  ServedTables *tables =
+      (ServedTables *)star_malloc(sizeof(ServedTables));
+  SolutionTable *table = new_solution_table();
+  if (tables == NULL || table == NULL) {
+    free(tables);
+    free(table);
+    return NULL;
+  }
+
+  while (!table->complete) {
+    extend_solution_table(table, 1);
+  }
+  tables->rule_set = rule_set;
+  memcpy(&tables->table, table, sizeof(SolutionTable));
+  free(table);
+  return tables;
+}
+
+static void release_reader_slot(void *slot) {
+  int released = (intptr_t)slot - 1;
+  uint64_t bit = (uint64_t)1 << (released % 64);
+  atomic_fetch_and(&readers_claimed[released / 64], ~bit);
+}
+
+static void create_reader_key() {
+  pthread_key_create(&reader_key, release_reader_slot);
+}
+
+/**
+ * Claims a free reader slot for the calling thread, if there's one left.
+ */
+static void claim_reader_slot() {
+  pthread_once(&reader_key_once, create_reader_key);
+  for (int word = 0; word < MAX_READERS / 64; word++) {
+    uint64_t claimed = atomic_load(&readers_claimed[word]);
+    while (~claimed != 0) {
+      int bit = __builtin_ctzll(~claimed);
+      if (atomic_compare_exchange_weak(&readers_claimed[word], &claimed,
+                                       claimed | (uint64_t)1 << bit)) {
+        reader_slot = word * 64 + bit;
+        // Stored plus one, since a `NULL` value doesn't call the destructor.
+        pthread_setspecific(reader_key, (void *)(intptr_t)(reader_slot + 1));
+        return;
+      }
+    }
+  }
+
+  if (!atomic_exchange(&readers_ran_out, true)) {
+    fprintf(stderr, "Too many threads reading tables, the others will "
+                    "search instead\n");
+  }
+}
+
+/**
+ * Returns the published tables, which are guaranteed to stay around until
+ * `stop_reading_tables` is called. Returns `NULL` if nothing is published, or
+ * if there are already too many readers.
+ */
+static ServedTables *start_reading_tables() {
+  if (reader_slot == -1) {
+    claim_reader_slot();
+  }
+  if (reader_slot == -1) {
+    return NULL;
+  }
+  atomic_store(&reader_epochs[reader_slot], atomic_load(&serving_epoch));
+  return atomic_load(&served_tables);
+}
+
+static void stop_reading_tables() {
+  if (reader_slot != -1) {
+    atomic_store(&reader_epochs[reader_slot], 0);
+  }
+}
+
+/**
+ * Publishes the given tables in place of the current ones, and frees those
+ * once no reader can be using them anymore.
+ */
+static void publish_tables(ServedTables *tables) {
+  ServedTables *old_tables = atomic_exchange(&served_tables, tables);
+  uint64_t epoch = atomic_fetch_add(&serving_epoch, 1) + 1;
+
+  // Readers that announced `epoch` or later read the epoch after the swap, so
+  // they can only have seen the new tables.
+  for (int slot = 0; slot < MAX_READERS; slot++) {
+    uint64_t reader_epoch;
+    while ((reader_epoch = atomic_load(&reader_epochs[slot])) != 0 &&
+           reader_epoch < epoch) {
+      sched_yield();
+    }
+  }
+  free(old_tables);
+}
+
+/**
+ * Same as `shortest_winning_moves`, answering from the published tables when
+ * there are any, and with a plain search using `context` otherwise.
+ */
+static int served_winning_moves(SolverContext *context, Grid grid,
+                                int moves[511]) {
+  ServedTables *tables = start_reading_tables();
+  if (tables == NULL) {
+    stop_reading_tables();
+    return shortest_winning_moves(context, grid, moves);
+  }
+
+  reset_solve_stats();
+  SolutionTable *table = &tables->table;
+  int length = -1;
+  if (table->knowledge[grid] == Solvable) {
+    for (length = 0; table->distance[grid] > 0; length++) {
+      solve_stats.nodes++;
+      moves[length] = table->next_move[grid];
+      grid = explode(grid, moves[length]);
+    }
+  }
+  stop_reading_tables();
+  return length;
+}
+
+/** FNV-1a, enough to tell a table that got mangled on the way. */
+static uint64_t checksum(unsigned char *bytes, int size) {
+  uint64_t hash = 0xCBF29CE484222325;
+  for (int i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3;
+  }
+  return hash;
+}
+
+/**
+ * Writes the published tables to a memory file that will be inherited by the
+ * next program this process `exec`s, and points that program to it through
+ * the `STAR_WARM_TABLES` environment variable. Returns `false` if there's
+ * nothing to hand over or the file couldn't be written.
+ */
+static bool hand_over_tables() {
+  unsigned char header[WARM_HEADER_BYTES];
+  unsigned char bytes[SOLUTION_TABLE_BYTES];
+  ServedTables *tables = start_reading_tables();
+  if (tables == NULL) {
+    stop_reading_tables();
+    return false;
+  }
+  encode_solution_table(&tables->table, bytes);
+  put_little_endian(header, tables->rule_set, 2);
+  stop_reading_tables();
+  put_little_endian(header + 2, sizeof(bytes), 4);
+  put_little_endian(header + 6, checksum(bytes, sizeof(bytes)), 8);
+
+  int fd = memfd_create("star-tables", 0);
+  int out_fd = fd != -1 ? dup(fd) : -1;
+  FILE *out = out_fd != -1 ? fdopen(out_fd, "wb") : NULL;
+  if (out == NULL && out_fd != -1) {
+    close(out_fd);
+  }
+  bool written =
+      out != NULL &&
+      fwrite(warm_tables_magic, sizeof(warm_tables_magic), 1, out) == 1 &&
+      fwrite(header, sizeof(header), 1, out) == 1 &&
+      fwrite(bytes, sizeof(bytes), 1, out) == 1;
+  written = out != NULL && fclose(out) == 0 && written;
+
+  char descriptor[16];
+  snprintf(descriptor, sizeof(descriptor), "%d", fd);
+  if (!written || setenv("STAR_WARM_TABLES", descriptor, 1) != 0) {
+    if (fd != -1) {
+      close(fd);
+    }
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Publishes the tables handed over by the process that `exec`ed this one, if
+ * any. Returns `true` if there were tables to take over.
+ *
+ * The program that handed them over may have been built with different rules
+ * or a different table layout: tables are only taken over if they're for the
+ * same rules, have the expected size and checksum and pass all the checks
+ * `load_solution_table` does. Otherwise they'll be built from scratch.
+ */
+static bool take_over_tables() {
+  char *descriptor = getenv("STAR_WARM_TABLES");
+  if (descriptor == NULL) {
+    return false;
+  }
+  int fd = atoi(descriptor);
+  unsetenv("STAR_WARM_TABLES");
+
+  FILE *in = fd > 2 && lseek(fd, 0, SEEK_SET) == 0 ? fdopen(fd, "rb") : NULL;
+  ServedTables *tables = (ServedTables *)star_malloc(sizeof(ServedTables));
+  char magic[sizeof(warm_tables_magic)];
+  unsigned char header[WARM_HEADER_BYTES];
+  unsigned char bytes[SOLUTION_TABLE_BYTES];
+  bool taken =
+      in != NULL && tables != NULL &&
+      fread(magic, sizeof(magic), 1, in) == 1 &&
+      memcmp(magic, warm_tables_magic, sizeof(magic)) == 0 &&
+      fread(header, sizeof(header), 1, in) == 1 &&
+      get_little_endian(header, 2) == rule_set &&
+      get_little_endian(header + 2, 4) == sizeof(bytes) &&
+      fread(bytes, sizeof(bytes), 1, in) == 1 &&
+      get_little_endian(header + 6, 8) == checksum(bytes, sizeof(bytes));
+  if (in != NULL) {
+    fclose(in);
+  }
+
+  if (tables != NULL) {
+    tables->rule_set = rule_set;
+    taken = taken && decode_solution_table(bytes, &tables->table);
+  }
+  if (!taken) {
+    fprintf(stderr, "Ignoring the tables handed over, they'll be rebuilt\n");
+    free(tables);
+    return false;
+  }
+  publish_tables(tables);
+  return true;
+}
+
+/** STREAMING ****************************************************************
+ * Solves grids read from a file descriptor for as long as there's input, one
+ * grid per line in the same format as command line arguments. For each grid a
+ * line is written with the grid, the number of moves (or -1) and the moves
+ * themselves, one digit each:
+ *
+ *     *../.../...	10	1235678954
+ *
+ * Input and output go through fixed size buffers and solves use a single
+ * `SolverContext`, so memory use stays the same no matter how long the stream
+ * goes on: allocations are trapped for the whole stream to make sure of it.
+ * At most a chunk of input is solved before results are written, and results
+ * never wait more than `max_delay` nanoseconds (plus the time it takes to
+ * solve a single grid) to be written out, even if input stops coming.
+ */
+
+#define STREAM_CHUNK 4096
+// A grid, the number of moves and the moves, with separators.
+#define MAX_RESULT_LINE (11 + 1 + 4 + 1 + 511 + 1)
+
+typedef struct Stream {
+  int in;
+  int out;
+  uint64_t max_delay;
+  SolverContext context;
+
+  // Input that hasn't been solved yet, a line can span chunks. `skipping` is
+  // set while dropping the rest of a line that's too long.
+  char input[STREAM_CHUNK];
+  int input_length;
+  bool skipping;
+
+  char output[STREAM_CHUNK + MAX_RESULT_LINE];
+  int output_length;
+  // When the oldest result waiting in `output` was written there.
+  uint64_t oldest_result;
+} Stream;
+
+/** Returns `false` if the output is gone. */
+static bool flush_stream(Stream *stream) {
+  for (int written = 0; written < stream->output_length;) {
+    ssize_t result = write(stream->out, stream->output + written,
+                           stream->output_length - written);
+    if (result < 0 && errno != EINTR) {
+      return false;
+    }
+    written += result > 0 ? result : 0;
+  }
+  stream->output_length = 0;
+  return true;
+}
+
+static bool solve_stream_line(Stream *stream, char *line, int length) {
+  if (stream->output_length + MAX_RESULT_LINE > (int)sizeof(stream->output) &&
+      !flush_stream(stream)) {
+    return false;
+  } else if (stream->output_length == 0) {
+    stream->oldest_result = now();
+  }
+
+  char argument[12] = "";
+  if (length == 11) {
+    memcpy(argument, line, 11);
+  }
+  Grid grid = parse_argument(argument);
+  char *out = stream->output + stream->output_length;
+  if (grid == error_grid) {
+    out += sprintf(out, "%.*s\tinvalid\n", length < 11 ? length : 11, line);
+  } else {
+    int moves[511];
+    uint64_t started_at = now();
+    int solution_length = shortest_winning_moves(&stream->context, grid, moves);
+    record_solve(ContextEngine, grid, started_at);
+    out += sprintf(out, "%s\t%d\t", argument, solution_length);
+    for (int m = 0; m < solution_length; m++) {
+      *out++ = '0' + moves[m];
+    }
+    *out++ = '\n';
+  }
+  stream->output_length = out - stream->output;
+  return true;
+}
+
+/**
+ * Solves all the complete lines in the input buffer, keeping what's left of
+ * the last one for the next chunk.
+ */
+static bool solve_stream_chunk(Stream *stream) {
+  int start = 0;
+  for (int i = 0; i < stream->input_length; i++) {
+    if (stream->input[i] != '\n') {
+      continue;
+    }
+    if (!stream->skipping &&
+        !solve_stream_line(stream, stream->input + start, i - start)) {
+      return false;
+    }
+    stream->skipping = false;
+    start = i + 1;
+
+    if (stream->output_length > 0 &&
+        now() - stream->oldest_result >= stream->max_delay &&
+        !flush_stream(stream)) {
+      return false;
+    }
+  }
+
+  stream->input_length -= start;
+  memmove(stream->input, stream->input + start, stream->input_length);
+  if (stream->input_length == (int)sizeof(stream->input)) {
+    // No line is this long, we report it as invalid and drop the rest of it
+    // up to the next newline.
+    bool reported = stream->skipping;
+    stream->input_length = 0;
+    stream->skipping = true;
+    return reported ||
+           solve_stream_line(stream, stream->input, sizeof(stream->input));
+  }
+  return true;
+}
+
+/**
+ * Solves the grids from the stream's input until it ends. Returns `false` if
+ * reading or writing fails.
+ *
+ * Signals (like the one asking for a flight recorder dump) interrupt reads and
+ * writes, those are simply retried.
+ */
+static bool run_stream(Stream *stream) {
+  AllocationPolicy policy = allocation_policy;
+  allocation_policy = TrapAllocations;
+  bool ok = true;
+
+  while (ok) {
+    int timeout = -1;
+    if (stream->output_length > 0) {
+      uint64_t waited = now() - stream->oldest_result;
+      timeout = waited >= stream->max_delay
+                    ? 0
+                    : (stream->max_delay - waited + 999999) / 1000000;
+    }
+    struct pollfd input = {.fd = stream->in, .events = POLLIN};
+    int ready = poll(&input, 1, timeout);
+    if (ready < 0) {
+      ok = errno == EINTR;
+      continue;
+    } else if (ready == 0) {
+      ok = flush_stream(stream);
+      continue;
+    }
+
+    ssize_t read_bytes =
+        read(stream->in, stream->input + stream->input_length,
+             sizeof(stream->input) - stream->input_length);
+    if (read_bytes < 0) {
+      ok = errno == EINTR;
+    } else if (read_bytes == 0) {
+      // A last line without a newline still counts.
+      if (stream->input_length > 0 && !stream->skipping) {
+        ok = solve_stream_line(stream, stream->input, stream->input_length);
+      }
+      break;
+    } else {
+      stream->input_length += read_bytes;
+      ok = solve_stream_chunk(stream);
+    }
+  }
+
+  ok = flush_stream(stream) && ok;
+  allocation_policy = policy;
+  return ok;
+}
+
+/** PLAYING THE ENTIRE GAME ***************************************************/
+
+typedef enum Mode { Chatty, Silent } Mode;
+
+void play(Grid grid, Mode mode) {
+  uint64_t started_at = now();
+  Path *winning_path = shortest_winning_path(grid);
+  record_solve(BfsEngine, grid, started_at);
+
+  if (mode == Chatty) {
+    if (winning_path == NULL) {
+      printf("There's no winning sequence of moves!\n");
+    } else {
+      print_path(winning_path);
+    }
+  }
+
+  drop_reference_to_path(winning_path);
+}
+
+/**
+ * Same as `play` but the table is used to answer the query and it's updated
+ * with whatever the search learns.
+ */
+void play_with_table(SolutionTable *table, Grid grid, Mode mode) {
+  uint64_t started_at = now();
+  Path *winning_path = shortest_winning_path_with_table(table, grid);
+  record_solve(TableEngine, grid, started_at);
+
+  if (mode == Chatty) {
+    if (winning_path == NULL) {
+      printf("There's no winning sequence of moves!\n");
+    } else {
+      print_path(winning_path);
+    }
+  }
+
+  drop_reference_to_path(winning_path);
+}
+
+/**
+ * `star table FILE GRID...`
+ *
+ * Plays all the given grids using the table stored in `FILE`, then spends a
+ * bit of time extending it before writing it back. Each run makes the table a
+ * little more complete.
+ */
+static int table_command(int argc, char **argv) {
+  SolutionTable *table = load_solution_table(argv[0]);
+  if (table == NULL) {
+    return 1;
+  }
+
+  for (int i = 1; i < argc; i++) {
+    Grid grid = parse_argument(argv[i]);
+    if (grid == error_grid) {
+      printf("Invalid grid: %s\n", argv[i]);
+      continue;
+    }
+    play_with_table(table, grid, Chatty);
+  }
+
+  extend_solution_table(table, 2);
+  bool saved = save_solution_table(table, argv[0]);
+  free(table);
+  return saved ? 0 : 1;
+}
+
+/**
+ * `star graph FILE`
+ *
+ * Writes the whole move graph to `FILE`, see `write_move_graph` for the format.
+ */
+static int graph_command(int argc, char **argv) {
+  (void)argc;
+  MoveGraph *graph = new_move_graph();
+  if (graph == NULL) {
+    return 1;
+  }
+
+  bool written = write_move_graph(graph, argv[0]);
+  free(graph);
+  return written ? 0 : 1;
+}
+
+/**
+ * `star components`
+ *
+ * Prints one line for each strongly connected component of the move graph,
+ * components made of a single grid are only counted.
+ */
+static int components_command() {
+  MoveGraph *graph = new_move_graph();
+  Components *components = graph == NULL ? NULL : find_components(graph);
+  if (components == NULL) {
+    free(graph);
+    return 1;
+  }
+
+  int single_grids = 0;
+  int traps = 0;
+  printf("component\tsize\tinternal\tincoming\toutgoing\twinning\tcan_win\n");
+  for (int c = 0; c < components->count; c++) {
+    Component *stats = &components->stats[c];
+    traps += stats->outgoing_edges == 0 && !stats->can_win;
+    if (stats->size == 1) {
+      single_grids++;
+    } else {
+      printf("%d\t%d\t%d\t%d\t%d\t%d\t%d\n", c, stats->size,
+             stats->internal_edges, stats->incoming_edges,
+             stats->outgoing_edges, stats->has_winning_grid, stats->can_win);
+    }
+  }
+  printf("components: %d, single grids: %d, traps: %d\n", components->count,
+         single_grids, traps);
+
+  free(components);
+  free(graph);
+  return 0;
+}
+
+/**
+ * `star chase GRID...`
+ *
+ * Plays all the given grids using the constructive solver followed by the
+ * post-optimizer, the moves are not always the shortest possible ones.
+ */
+static int chase_command(int argc, char **argv) {
+  ConstructiveSolver *solver = new_constructive_solver();
+  if (solver == NULL) {
+    return 1;
+  }
+
+  for (int i = 0; i < argc; i++) {
+    Grid grid = parse_argument(argv[i]);
+    if (grid == error_grid) {
+      printf("Invalid grid: %s\n", argv[i]);
+      continue;
+    }
+
+    uint64_t started_at = now();
+    Path *constructed_path = constructive_winning_path(solver, grid);
+    record_solve(ConstructiveEngine, grid, started_at);
+    Path *winning_path = optimize_path(grid, constructed_path);
+    drop_reference_to_path(constructed_path);
+    if (winning_path == NULL) {
+      printf("There's no winning sequence of moves!\n");
+    } else {
+      print_path(winning_path);
+    }
+    drop_reference_to_path(winning_path);
+  }
+
+  free_constructive_solver(solver);
+  return 0;
+}
+
+/**
+ * `star zero-alloc`
+ *
+ * Plays every possible grid using a solver context while trapping allocations,
+ * the first round is used to warm up and doesn't trap anything.
+ * Any allocation after the warm up aborts the program.
+ */
+static int zero_alloc_command() {
+  static SolverContext context;
+  int moves[511];
+  init_solver_context(&context);
+
+  for (int round = 0; round < 2; round++) {
+    long allocations_before = allocations;
+    allocation_policy = round == 0 ? AllowAllocations : TrapAllocations;
+    for (int grid = empty_grid; grid < 512; grid++) {
+      uint64_t started_at = now();
+      shortest_winning_moves(&context, grid, moves);
+      record_solve(ContextEngine, grid, started_at);
+    }
+    allocation_policy = AllowAllocations;
+    printf("round %d: %ld allocations\n", round,
+           allocations - allocations_before);
+  }
+  return 0;
+}
+
+/**
+ * `star dense GRID...`
+ *
+ * Builds dense tables for all the grids reachable from the given ones and uses
+ * them to play each of those.
+ */
+static int dense_command(int argc, char **argv) {
+  Grid starts[512];
+  int count = 0;
+  for (int i = 0; i < argc && count < 512; i++) {
+    Grid grid = parse_argument(argv[i]);
+    if (grid == error_grid) {
+      printf("Invalid grid: %s\n", argv[i]);
+    } else {
+      starts[count++] = grid;
+    }
+  }
+
+  DenseTables *tables = new_dense_tables(starts, count);
+  if (tables == NULL) {
+    return 1;
+  }
+  printf("%d reachable grids, tables take %d bytes instead of %d\n",
+         tables->index.count, 2 * tables->index.count, 2 * 512);
+
+  int moves[511];
+  for (int s = 0; s < count; s++) {
+    uint64_t started_at = now();
+    int length = dense_winning_moves(tables, starts[s], moves);
+    record_solve(DenseEngine, starts[s], started_at);
+    if (length < 0) {
+      printf("There's no winning sequence of moves!\n");
+    }
+    for (int i = 0; i < length; i++) {
+      printf("%d\n", moves[i]);
+    }
+  }
+
+  free_dense_tables(tables);
+  return 0;
+}
+
+/**
+ * `star orbits GRID...`
+ *
+ * Plays the given grids using a table with a single entry for each orbit of
+ * grids under the symmetries of the board.
+ */
+static int orbits_command(int argc, char **argv) {
+  SolutionTable *solutions = new_solution_table();
+  if (solutions == NULL) {
+    return 1;
+  }
+  extend_solution_table(solutions, 512);
+  OrbitTable *table = new_orbit_table(solutions);
+  free(solutions);
+  if (table == NULL) {
+    return 1;
+  }
+  printf("%d orbits instead of 512 grids\n", table->symmetries->orbits);
+
+  int moves[511];
+  for (int i = 0; i < argc; i++) {
+    Grid grid = parse_argument(argv[i]);
+    if (grid == error_grid) {
+      printf("Invalid grid: %s\n", argv[i]);
+      continue;
+    }
+
+    uint64_t started_at = now();
+    int length = orbit_winning_moves(table, grid, moves);
+    record_solve(OrbitEngine, grid, started_at);
+    if (length < 0) {
+      printf("There's no winning sequence of moves!\n");
+    }
+    for (int m = 0; m < length; m++) {
+      printf("%d\n", moves[m]);
+    }
+  }
+
+  free_orbit_table(table);
+  return 0;
+}
+
+/**
+ * `star record GRID...`
+ *
+ * Plays the given grids with the bfs, table and solver context engines and
+ * dumps everything the flight recorder saw.
+ */
+static int record_command(int argc, char **argv) {
+  SolutionTable *table = new_solution_table();
+  static SolverContext context;
+  int moves[511];
+  if (table == NULL) {
+    return 1;
+  }
+  init_solver_context(&context);
+
+  for (int i = 0; i < argc; i++) {
+    Grid grid = parse_argument(argv[i]);
+    if (grid == error_grid) {
+      printf("Invalid grid: %s\n", argv[i]);
+      continue;
+    }
+
+    play(grid, Silent);
+    play_with_table(table, grid, Silent);
+    uint64_t started_at = now();
+    shortest_winning_moves(&context, grid, moves);
+    record_solve(ContextEngine, grid, started_at);
+  }
+
+  dump_flight_recorders(stdout);
+  free(table);
+  return 0;
+}
+
+typedef struct BatchSolve {
+  SolverContext contexts[MAX_WORKERS];
+  Grid *grids;
+  int *lengths;
+} BatchSolve;
+
+static void solve_batch_grid(void *context, int worker, int index) {
+  BatchSolve *batch = (BatchSolve *)context;
+  int moves[511];
+  uint64_t started_at = now();
+  batch->lengths[index] =
+      shortest_winning_moves(&batch->contexts[worker], batch->grids[index],
+                             moves);
+  record_solve(ContextEngine, batch->grids[index], started_at);
+}
+
+/**
+ * `star batch [REPEAT]`
+ *
+ * Solves every possible grid `REPEAT` times (1000 by default) on the worker
+ * pool, printing the number of active workers and the throughput of each
+ * round. Tasks are numbered with an `int`, so `REPEAT` can't go past
+ * `INT_MAX / 512`.
+ */
+static int batch_command(int argc, char **argv) {
+  long repeat = argc > 0 ? atol(argv[0]) : 1000;
+  if (repeat > INT_MAX / 512) {
+    printf("Too many repeats, at most %d\n", INT_MAX / 512);
+    return 1;
+  }
+  int count = 512 * (repeat > 0 ? (int)repeat : 1);
+  BatchSolve *batch = (BatchSolve *)star_malloc(sizeof(BatchSolve));
+  WorkerPool *pool = new_worker_pool();
+  if (batch == NULL || pool == NULL) {
+    free(batch);
+    if (pool != NULL) {
+      free_worker_pool(pool);
+    }
+    return 1;
+  }
+
+  batch->grids = (Grid *)star_malloc(sizeof(Grid) * count);
+  batch->lengths = (int *)star_malloc(sizeof(int) * count);
+  if (batch->grids == NULL || batch->lengths == NULL) {
+    free(batch->grids);
+    free(batch->lengths);
+    free(batch);
+    free_worker_pool(pool);
+    return 1;
+  }
+  for (int i = 0; i < MAX_WORKERS; i++) {
+    init_solver_context(&batch->contexts[i]);
+  }
+  for (int i = 0; i < count; i++) {
+    batch->grids[i] = i % 512;
+  }
+
+  printf("round\tworkers\tgrids_per_second\n");
+  run_adaptive(pool, solve_batch_grid, batch, count, 8192, stdout);
+  for (int i = 0; i < pool->workers; i++) {
+    printf("worker %d solved %ld grids\n", i, pool->completed[i]);
+  }
+
+  free_worker_pool(pool);
+  free(batch->grids);
+  free(batch->lengths);
+  free(batch);
+  return 0;
+}
+
+/**
+ * `star fog GRID...`
+ *
+ * Plays the given grids in fog mode, where hidden cells are written as `?`:
+ * for example `*?./.*./..?`.
+ */
+static int fog_command(int argc, char **argv) {
+  int moves[511];
+  for (int i = 0; i < argc; i++) {
+    char visible[12];
+    Grid hidden = empty_grid;
+    strncpy(visible, argv[i], sizeof(visible) - 1);
+    visible[sizeof(visible) - 1] = '\0';
+    for (int c = 0, cell = 1; visible[c] != '\0'; c++) {
+      if (visible[c] == '?') {
+        visible[c] = '.';
+        hidden |= cell1 >> (cell - 1);
+      }
+      cell += visible[c] != '/';
+    }
+
+    Grid grid = parse_argument(visible);
+    if (grid == error_grid || strlen(argv[i]) != 11) {
+      printf("Invalid grid: %s\n", argv[i]);
+      continue;
+    }
+
+    uint64_t started_at = now();
+    int length = fog_winning_moves(grid, hidden, moves);
+    record_solve(FogEngine, grid, started_at);
+    if (length == TOO_MANY_BELIEFS) {
+      printf("Gave up after %d possible sets of grids!\n", MAX_BELIEFS);
+    } else if (length < 0) {
+      printf("There's no winning sequence of moves!\n");
+    }
+    for (int m = 0; m < length; m++) {
+      printf("%d\n", moves[m]);
+    }
+  }
+  return 0;
+}
+
+/**
+ * `star constrained CONSTRAINT... GRID...`
+ *
+ * Plays the given grids under some constraints: `CELL=N` means the cell can be
+ * exploded at most `N` times, `moves=N` allows at most `N` moves in total.
+ * For example: `star constrained 5=2 moves=12 '*../.../...'`.
+ */
+static int constrained_command(int argc, char **argv) {
+  Constraints constraints = no_constraints();
+  int moves[511];
+  for (int i = 0; i < argc; i++) {
+    int cell, limit;
+    if (sscanf(argv[i], "moves=%d", &limit) == 1) {
+      constraints.max_moves = limit;
+      continue;
+    } else if (sscanf(argv[i], "%d=%d", &cell, &limit) == 2 && cell >= 1 &&
+               cell <= 9) {
+      constraints.max_explosions[cell] = limit;
+      continue;
+    }
+
+    Grid grid = parse_argument(argv[i]);
+    if (grid == error_grid) {
+      printf("Invalid grid: %s\n", argv[i]);
+      continue;
+    }
+
+    uint64_t started_at = now();
+    int length = constrained_winning_moves(&constraints, grid, moves);
+    record_solve(ConstrainedEngine, grid, started_at);
+    if (length == CONSTRAINTS_TOO_LARGE) {
+      printf("The constraints are too large to search!\n");
+    } else if (length < 0) {
+      printf("There's no winning sequence of moves!\n");
+    }
+    for (int m = 0; m < length; m++) {
+      printf("%d\n", moves[m]);
+    }
+  }
+  return 0;
+}
+
+/**
+ * `star multi GRID...`
+ *
+ * Plays all the given grids at once with a single multi-source bfs, at most
+ * `MAX_QUERIES` of them.
+ */
+static int multi_command(int argc, char **argv) {
+  Grid starts[MAX_QUERIES];
+  int lengths[MAX_QUERIES];
+  static int moves[MAX_QUERIES][511];
+  int count = 0;
+  for (int i = 0; i < argc && count < MAX_QUERIES; i++) {
+    Grid grid = parse_argument(argv[i]);
+    if (grid == error_grid) {
+      printf("Invalid grid: %s\n", argv[i]);
+    } else {
+      starts[count++] = grid;
+    }
+  }
+
+  if (!multi_source_winning_moves(starts, count, lengths, moves)) {
+    return 1;
+  }
+
+  for (int q = 0; q < count; q++) {
+    if (lengths[q] < 0) {
+      printf("There's no winning sequence of moves!\n");
+    }
+    for (int m = 0; m < lengths[q]; m++) {
+      printf("%d\n", moves[q][m]);
+    }
+  }
+  return 0;
+}
+
+/**
+ * `star oracle FROM TO [LANDMARKS]`
+ *
+ * Prints the shortest sequence of moves from `FROM` to `TO` found with the
+ * distance matrix, and how many grids A* had to expand to find one just as
+ * short using the given number of landmarks (4 by default).
+ */
+static int oracle_command(int argc, char **argv) {
+  Grid from = parse_argument(argv[0]);
+  Grid to = parse_argument(argv[1]);
+  int count = argc > 2 ? atoi(argv[2]) : 4;
+  if (from == error_grid || to == error_grid) {
+    printf("Invalid grid\n");
+    return 1;
+  }
+
+  MoveGraph *graph = new_move_graph();
+  WorkerPool *pool = new_worker_pool();
+  DistanceMatrix *matrix =
+      graph == NULL ? NULL : new_distance_matrix(graph, pool);
+  Landmarks *landmarks = graph == NULL ? NULL : new_landmarks(graph, count);
+  int status = 1;
+  if (matrix != NULL && landmarks != NULL) {
+    int moves[511];
+    int length = matrix_moves(matrix, from, to, moves);
+    if (length < 0) {
+      printf("There's no sequence of moves!\n");
+    }
+    for (int m = 0; m < length; m++) {
+      printf("%d\n", moves[m]);
+    }
+
+    uint64_t started_at = now();
+    int landmark_length = landmark_moves(landmarks, from, to, moves);
+    record_solve(LandmarkEngine, from, started_at);
+    printf("A* with %d landmarks: %d moves, %u grids expanded\n",
+           landmarks->count, landmark_length, solve_stats.nodes);
+    status = 0;
+  }
+
+  if (pool != NULL) {
+    free_worker_pool(pool);
+  }
+  free(landmarks);
+  free(matrix);
+  free(graph);
+  return status;
+}
+
+/**
+ * `star depth-first [KB]`
+ *
+ * Solves every grid with iterative deepening, first without a transposition
+ * table and then with one of `KB` kilobytes shared by all solves, and checks
+ * every answer against a bfs.
+ */
+static int depth_first_command(int argc, char **argv) {
+  long kilobytes = argc > 0 ? atol(argv[0]) : 64;
+  TranspositionTable *table =
+      new_transposition_table(kilobytes > 0 ? kilobytes * 1024 : 0);
+  SolverContext *context =
+      (SolverContext *)star_malloc(sizeof(SolverContext));
+  if (table == NULL || context == NULL) {
+    if (table != NULL) {
+      free_transposition_table(table);
+    }
+    free(context);
+    return 1;
+  }
+  init_solver_context(context);
+
+  int wrong_answers = 0;
+  for (int round = 0; round < 2; round++) {
+    TranspositionTable *used_table = round == 0 ? NULL : table;
+    long nodes = 0;
+    for (int grid = empty_grid; grid < 512; grid++) {
+      int moves[511];
+      int expected_moves[511];
+      uint64_t started_at = now();
+      int length = depth_first_winning_moves(used_table, grid, moves);
+      record_solve(DepthFirstEngine, grid, started_at);
+      nodes += solve_stats.nodes;
+      if (length != shortest_winning_moves(context, grid, expected_moves)) {
+        wrong_answers++;
+      }
+    }
+    printf("%s: %ld nodes\n",
+           used_table == NULL ? "no table" : "transposition table", nodes);
+  }
+  printf("%d wrong answers\n", wrong_answers);
+
+  free_transposition_table(table);
+  free(context);
+  return wrong_answers == 0 ? 0 : 1;
+}
+
+/**
+ * `star shards [PREFIX]`
+ *
+ * Builds the tables one shard per coset, checks them against a bfs and, if a
+ * prefix is given, writes shard `n` to `PREFIX.n` and reads it back.
+ */
+static int shards_command(int argc, char **argv) {
+  WorkerPool *pool = new_worker_pool();
+  ShardedTables *tables = new_sharded_tables(pool);
+  SolverContext *context =
+      (SolverContext *)star_malloc(sizeof(SolverContext));
+  if (pool != NULL) {
+    free_worker_pool(pool);
+  }
+  if (tables == NULL || context == NULL) {
+    if (tables != NULL) {
+      free_sharded_tables(tables);
+    }
+    free(context);
+    return 1;
+  }
+
+  printf("rank %d: %d shards of %d grids\n", tables->partition.rank,
+         tables->partition.cosets, tables->grids_per_shard);
+  int status = 0;
+  for (int coset = 0; argc > 0 && coset < tables->partition.cosets; coset++) {
+    char file[1024];
+    snprintf(file, sizeof(file), "%s.%d", argv[0], coset);
+    if (!save_shard(tables, coset, file) ||
+        !load_shard(tables, coset, file)) {
+      printf("Couldn't write shard %d to %s\n", coset, file);
+      status = 1;
+    }
+  }
+
+  init_solver_context(context);
+  int wrong_answers = 0;
+  for (int grid = empty_grid; grid < 512; grid++) {
+    int moves[511];
+    int expected_moves[511];
+    if (sharded_winning_moves(tables, grid, moves) !=
+        shortest_winning_moves(context, grid, expected_moves)) {
+      wrong_answers++;
+    }
+  }
+  printf("%d wrong answers\n", wrong_answers);
+
+  free_sharded_tables(tables);
+  free(context);
+  return wrong_answers == 0 ? status : 1;
+}
+
+typedef struct HotSwap {
+  SolverContext contexts[MAX_WORKERS];
+  uint64_t slowest[MAX_WORKERS];
+  atomic_int wrong_answers;
+  atomic_bool swapping;
+  int swaps;
+} HotSwap;
+
+static void serve_hot_swap_grid(void *context, int worker, int index) {
+  HotSwap *hot_swap = (HotSwap *)context;
+  Grid grid = index % 512;
+  int moves[511];
+  int expected_moves[511];
+  uint64_t started_at = now();
+  int length =
+      served_winning_moves(&hot_swap->contexts[worker], grid, moves);
+  record_solve(TableEngine, grid, started_at);
+  uint64_t latency = now() - started_at;
+  if (latency > hot_swap->slowest[worker]) {
+    hot_swap->slowest[worker] = latency;
+  }
+
+  if (length != shortest_winning_moves(&hot_swap->contexts[worker], grid,
+                                       expected_moves)) {
+    atomic_fetch_add(&hot_swap->wrong_answers, 1);
+  }
+}
+
+static void *run_table_swaps(void *argument) {
+  HotSwap *hot_swap = (HotSwap *)argument;
+  for (int swap = 0; swap < hot_swap->swaps; swap++) {
+    ServedTables *tables = new_served_tables(rule_set);
+    if (tables != NULL) {
+      publish_tables(tables);
+    }
+  }
+  atomic_store(&hot_swap->swapping, false);
+  return NULL;
+}
+
+/**
+ * `star stream [MAX_DELAY_MS]`
+ *
+ * Solves the grids coming from the standard input as they come, see
+ * `run_stream`. Results wait at most 10ms by default.
+ */
+static int stream_command(int argc, char **argv) {
+  // The stream takes a few KB, too much for some stacks.
+  static Stream stream;
+  stream.in = STDIN_FILENO;
+  stream.out = STDOUT_FILENO;
+  stream.max_delay = (argc > 0 ? atol(argv[0]) : 10) * 1000000;
+  init_solver_context(&stream.context);
+  return run_stream(&stream) ? 0 : 1;
+}
+
+/**
+ * `star hot-swap [SWAPS]`
+ *
+ * Keeps answering queries from the published tables on all cores while the
+ * tables are replaced `SWAPS` times, and checks every single answer.
+ */
+static int hot_swap_command(int argc, char **argv) {
+  HotSwap *hot_swap = (HotSwap *)star_calloc(1, sizeof(HotSwap));
+  WorkerPool *pool = new_worker_pool();
+  ServedTables *tables = new_served_tables(rule_set);
+  if (hot_swap == NULL || pool == NULL || tables == NULL) {
+    free(hot_swap);
+    free(tables);
+    if (pool != NULL) {
+      free_worker_pool(pool);
+    }
+    return 1;
+  }
+
+  for (int i = 0; i < MAX_WORKERS; i++) {
+    init_solver_context(&hot_swap->contexts[i]);
+  }
+  hot_swap->swaps = argc > 0 ? atoi(argv[0]) : 1000;
+  atomic_store(&hot_swap->swapping, true);
+  publish_tables(tables);
+
+  pthread_t swapper;
+  if (pthread_create(&swapper, NULL, run_table_swaps, hot_swap) != 0) {
+    free(hot_swap);
+    free_worker_pool(pool);
+    return 1;
+  }
+  long queries = 0;
+  do {
+    run_round(pool, serve_hot_swap_grid, hot_swap, 0, 512);
+    queries += 512;
+  } while (atomic_load(&hot_swap->swapping));
+  pthread_join(swapper, NULL);
+
+  uint64_t slowest = 0;
+  for (int i = 0; i < pool->workers; i++) {
+    slowest = hot_swap->slowest[i] > slowest ? hot_swap->slowest[i] : slowest;
+  }
+  int wrong_answers = atomic_load(&hot_swap->wrong_answers);
+  printf("%ld queries during %d swaps, %d wrong answers, slowest %llu ns\n",
+         queries, hot_swap->swaps, wrong_answers,
+         (unsigned long long)slowest);
+
+  free_worker_pool(pool);
+  free(hot_swap);
+  return wrong_answers == 0 ? 0 : 1;
+}
+
+/**
+ * `star warm-restart [RESTARTS]`
+ *
+ * Serves a query, then restarts the program `RESTARTS` times handing the
+ * tables over each time, to show that only the first start is a cold one.
+ */
+static int warm_restart_command(int argc, char **argv) {
+  int restarts = argc > 0 ? atoi(argv[0]) : 1;
+  uint64_t started_at = now();
+  ServedTables *tables = start_reading_tables();
+  stop_reading_tables();
+  if (tables != NULL) {
+    printf("Warm start: took over the tables\n");
+  } else if ((tables = new_served_tables(rule_set)) != NULL) {
+    publish_tables(tables);
+    printf("Cold start: built the tables in %llu ns\n",
+           (unsigned long long)(now() - started_at));
+  } else {
+    return 1;
+  }
+
+  SolverContext *context =
+      (SolverContext *)star_malloc(sizeof(SolverContext));
+  if (context == NULL) {
+    return 1;
+  }
+  init_solver_context(context);
+  int moves[511];
+  started_at = now();
+  int length = served_winning_moves(context, 0b100000000, moves);
+  record_solve(TableEngine, 0b100000000, started_at);
+  printf("First query answered in %llu ns (%d moves)\n",
+         (unsigned long long)(now() - started_at), length);
+  free(context);
+
+  if (restarts <= 0) {
+    return 0;
+  } else if (!hand_over_tables()) {
+    printf("Couldn't hand over the tables\n");
+    return 1;
+  }
+
+  char left[16];
+  snprintf(left, sizeof(left), "%d", restarts - 1);
+  char *arguments[] = {"star", "warm-restart", left, NULL};
+  // Whatever is still buffered would be lost. The restarted program keeps on
+  // capturing to the same file, it mustn't start it over.
+  fflush(stdout);
+  stop_capture();
+  setenv("STAR_CAPTURE_APPEND", "1", 1);
+  execv("/proc/self/exe", arguments);
+  printf("Couldn't restart\n");
+  return 1;
+}
+
+/**
+ * `star steps text|html|ansi [GRID...]`
+ *
+ * Shows every step of the solution for each grid, or for all grids if none is
+ * given.
+ */
+static int steps_command(int argc, char **argv) {
+  static const char *styles[] = {"text", "html", "ansi"};
+  int style = 0;
+  while (style < 3 && strcmp(argv[0], styles[style]) != 0) {
+    style++;
+  }
+  Renderer renderer;
+  SolverContext *context =
+      (SolverContext *)star_malloc(sizeof(SolverContext));
+  if (context == NULL || !init_renderer(&renderer, (RenderStyle)style)) {
+    printf("Unknown style: %s\n", argv[0]);
+    free(context);
+    return 1;
+  }
+  init_solver_context(context);
+
+  int status = 0;
+  int grids = argc > 1 ? argc - 1 : 512;
+  for (int i = 0; i < grids; i++) {
+    Grid grid = argc > 1 ? parse_argument(argv[i + 1]) : i;
+    if (grid == error_grid) {
+      printf("Invalid grid: %s\n", argv[i + 1]);
+      continue;
+    }
+
+    int moves[511];
+    int length = shortest_winning_moves(context, grid, moves);
+    if (length < 0) {
+      printf("There's no winning sequence of moves!\n");
+      continue;
+    }
+    long size = render_steps(&renderer, grid, moves, length);
+    if (size < 0) {
+      printf("Not enough memory to render the steps!\n");
+      status = 1;
+      continue;
+    }
+    fwrite(renderer.buffer, 1, size, stdout);
+  }
+
+  free_renderer(&renderer);
+  free(context);
+  return status;
+}
+
+/** SCALING BENCHMARK *********************************************************
+ * Measures how each engine scales with the number of threads, on a fixed set
+ * of starting grids drawn from a seeded generator. One line per engine and
+ * thread count in a tab separated format meant to stay the same from one
+ * version to the next, so results can be compared. Each line has:
+ * - the solve latency percentiles, in nanoseconds;
+ * - the grids (or table entries) visited per second, and solves per second;
+ * - the bytes allocated per solve and the size of the engine's tables;
+ * - the peak resident set size of the process during the run (setup
+ *   included) in KB, or -1 where the peak can't be reset between runs;
+ * - the parallel efficiency: solves per second divided by the thread count
+ *   and by the solves per second with a single thread.
+ *
+ * Boards have a size column, but for now the rules in `explode` are for a
+ * 3x3 board only.
+ */
+
+#define SCALING_SEED 0x5354415253434C45
+
+static const Engine scaling_engines[] = {BfsEngine,   ContextEngine,
+                                         TableEngine, DenseEngine,
+                                         OrbitEngine, LandmarkEngine,
+                                         DepthFirstEngine};
+
+// Per worker, each on its own cache line so that workers never write to the
+// same one.
+typedef struct ScalingCounters {
+  _Alignas(64) long nodes;
+  long bytes;
+} ScalingCounters;
+
+typedef struct ScalingRun {
+  Engine engine;
+  Grid *starts;
+  uint64_t *latencies;
+  void *allocation;
+  ScalingCounters *counters;
+  SolverContext contexts[MAX_WORKERS];
+
+  DenseTables *dense;
+  OrbitTable *orbits;
+  MoveGraph *graph;
+  Landmarks *landmarks;
+  TranspositionTable *transpositions;
+} ScalingRun;
+
+/** A xorshift generator, so the starting grids are the same everywhere. */
+static uint64_t next_random(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static void run_scaling_solve(void *context, int worker, int index) {
+  ScalingRun *run = (ScalingRun *)context;
+  Grid grid = run->starts[index];
+  int moves[511];
+  long bytes_before = allocated_bytes;
+  uint64_t started_at = now();
+  switch (run->engine) {
+  case BfsEngine:
+    drop_reference_to_path(shortest_winning_path(grid));
+    break;
+  case ContextEngine:
+    shortest_winning_moves(&run->contexts[worker], grid, moves);
+    break;
+  case TableEngine:
+    served_winning_moves(&run->contexts[worker], grid, moves);
+    break;
+  case DenseEngine:
+    dense_winning_moves(run->dense, grid, moves);
+    break;
+  case OrbitEngine:
+    orbit_winning_moves(run->orbits, grid, moves);
+    break;
+  case LandmarkEngine:
+    landmark_moves(run->landmarks, grid, winning_grid, moves);
+    break;
+  case DepthFirstEngine:
+    depth_first_winning_moves(run->transpositions, grid, moves);
+    break;
+  default:
+    break;
+  }
+  run->latencies[index] = now() - started_at;
+  run->counters[worker].nodes += solve_stats.nodes;
+  run->counters[worker].bytes += allocated_bytes - bytes_before;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+  uint64_t first = *(const uint64_t *)a;
+  uint64_t second = *(const uint64_t *)b;
+  return (first > second) - (first < second);
+}
+
+/**
+ * Makes the peak resident set size of the process start again from the
+ * current one. Returns `false` if the kernel doesn't allow it.
+ */
+static bool reset_peak_rss() {
+  FILE *out = fopen("/proc/self/clear_refs", "w");
+  if (out == NULL) {
+    return false;
+  }
+  bool reset = fputs("5", out) >= 0;
+  return fclose(out) == 0 && reset;
+}
+
+/** The peak resident set size of the process in KB, or -1 if unknown. */
+static long peak_rss() {
+  FILE *in = fopen("/proc/self/status", "r");
+  if (in == NULL) {
+    return -1;
+  }
+  char line[128];
+  long peak = -1;
+  while (fgets(line, sizeof(line), in) != NULL) {
+    if (sscanf(line, "VmHWM: %ld kB", &peak) == 1) {
+      break;
+    }
+  }
+  fclose(in);
+  return peak;
+}
+
+/**
+ * Builds whatever the engine needs before solving, returns the size of its
+ * tables or -1 if there's not enough memory.
+ */
+static long setup_scaling_run(ScalingRun *run, int count) {
+  switch (run->engine) {
+  case TableEngine: {
+    ServedTables *tables = new_served_tables(rule_set);
+    if (tables != NULL) {
+      publish_tables(tables);
+    }
+    return tables == NULL ? -1 : (long)sizeof(ServedTables);
+  }
+  case DenseEngine:
+    run->dense = new_dense_tables(run->starts, count);
+    return run->dense == NULL
+               ? -1
+               : (long)sizeof(DenseTables) + 2 * run->dense->index.count;
+  case OrbitEngine: {
+    SolutionTable *solutions = new_solution_table();
+    if (solutions != NULL) {
+      extend_solution_table(solutions, 512);
+      run->orbits = new_orbit_table(solutions);
+      free(solutions);
+    }
+    return run->orbits == NULL ? -1
+                               : (long)(sizeof(OrbitTable) +
+                                        sizeof(Symmetries)) +
+                                     (2 + (long)sizeof(Grid)) *
+                                         run->orbits->symmetries->orbits;
+  }
+  case LandmarkEngine:
+    run->graph = new_move_graph();
+    run->landmarks = run->graph == NULL ? NULL : new_landmarks(run->graph, 4);
+    return run->landmarks == NULL
+               ? -1
+               : (long)(sizeof(MoveGraph) + sizeof(Landmarks));
+  case DepthFirstEngine:
+    run->transpositions = new_transposition_table(64 * 1024);
+    return run->transpositions == NULL
+               ? -1
+               : (long)(run->transpositions->bucket_count *
+                        sizeof(TranspositionBucket));
+  case ContextEngine:
+    return sizeof(SolverContext);
+  default:
+    return 0;
+  }
+}
+
+static void free_scaling_run(ScalingRun *run) {
+  if (run->engine == TableEngine) {
+    publish_tables(NULL);
+  }
+  if (run->dense != NULL) {
+    free_dense_tables(run->dense);
+  }
+  free_orbit_table(run->orbits);
+  free(run->landmarks);
+  free(run->graph);
+  if (run->transpositions != NULL) {
+    free_transposition_table(run->transpositions);
+  }
+  run->dense = NULL;
+  run->orbits = NULL;
+  run->landmarks = NULL;
+  run->graph = NULL;
+  run->transpositions = NULL;
+}
+
+/**
+ * `star bench-scaling [STARTS]`
+ *
+ * Runs the scaling benchmark on `STARTS` grids, see above. Thread counts go
+ * up in powers of 2 to the number of available cores.
+ */
+static int bench_scaling_command(int argc, char **argv) {
+  int count = argc > 0 ? atoi(argv[0]) : 4096;
+  count = count > 0 ? count : 1;
+  ScalingRun *run = (ScalingRun *)star_calloc(1, sizeof(ScalingRun));
+  WorkerPool *pool = new_worker_pool();
+  if (run != NULL) {
+    run->starts = (Grid *)star_malloc(sizeof(Grid) * count);
+    run->latencies = (uint64_t *)star_malloc(sizeof(uint64_t) * count);
+    // Leaves room to align the counters to a cache line.
+    run->allocation =
+        star_malloc(MAX_WORKERS * sizeof(ScalingCounters) + 64);
+    run->counters =
+        (ScalingCounters *)(((uintptr_t)run->allocation + 63) &
+                            ~(uintptr_t)63);
+  }
+  if (run == NULL || pool == NULL || run->starts == NULL ||
+      run->latencies == NULL || run->allocation == NULL) {
+    if (run != NULL) {
+      free(run->starts);
+      free(run->latencies);
+      free(run->allocation);
+    }
+    free(run);
+    if (pool != NULL) {
+      free_worker_pool(pool);
+    }
+    return 1;
+  }
+
+  uint64_t state = SCALING_SEED;
+  for (int i = 0; i < count; i++) {
+    run->starts[i] = next_random(&state) & full_grid;
+  }
+  for (int i = 0; i < MAX_WORKERS; i++) {
+    init_solver_context(&run->contexts[i]);
+  }
+
+  printf("engine\tboard\tseed\tstarts\tthreads\tp50_ns\tp90_ns\tp99_ns"
+         "\tmax_ns\tstates_per_second\tsolves_per_second\tbytes_per_solve"
+         "\ttable_bytes\tpeak_rss_kb\tefficiency\n");
+  int engines = sizeof(scaling_engines) / sizeof(Engine);
+  for (int e = 0; e < engines; e++) {
+    double single_thread_throughput = 0;
+    for (int threads = 1; threads <= pool->workers;
+         threads = threads < pool->workers && threads * 2 > pool->workers
+                       ? pool->workers
+                       : threads * 2) {
+      // Each run starts from scratch, so later runs don't find the tables
+      // already warmed up.
+      run->engine = scaling_engines[e];
+      bool peak_reset = reset_peak_rss();
+      long table_bytes = setup_scaling_run(run, count);
+      if (table_bytes < 0) {
+        free_scaling_run(run);
+        break;
+      }
+      memset(run->counters, 0, MAX_WORKERS * sizeof(ScalingCounters));
+      pthread_mutex_lock(&pool->lock);
+      pool->active_workers = threads;
+      pthread_mutex_unlock(&pool->lock);
+
+      uint64_t started_at = now();
+      run_round(pool, run_scaling_solve, run, 0, count);
+      double seconds = (now() - started_at) / 1e9;
+      seconds = seconds > 0 ? seconds : 1e-9;
+      long peak_rss_kb = peak_reset ? peak_rss() : -1;
+      free_scaling_run(run);
+
+      long nodes = 0;
+      long bytes = 0;
+      for (int i = 0; i < pool->workers; i++) {
+        nodes += run->counters[i].nodes;
+        bytes += run->counters[i].bytes;
+      }
+      qsort(run->latencies, count, sizeof(uint64_t), compare_latencies);
+      double throughput = count / seconds;
+      if (threads == 1) {
+        single_thread_throughput = throughput;
+      }
+      printf("%s\t3x3\t%llx\t%d\t%d\t%llu\t%llu\t%llu\t%llu\t%.0f\t%.0f\t%ld"
+             "\t%ld\t%ld\t%.3f\n",
+             engine_names[run->engine], (unsigned long long)SCALING_SEED,
+             count, threads,
+             (unsigned long long)run->latencies[count / 2],
+             (unsigned long long)run->latencies[count * 9 / 10],
+             (unsigned long long)run->latencies[count * 99 / 100],
+             (unsigned long long)run->latencies[count - 1], nodes / seconds,
+             throughput, bytes / count, table_bytes, peak_rss_kb,
+             throughput / (threads * single_thread_throughput));
+    }
+  }
+
+  free_worker_pool(pool);
+  free(run->starts);
+  free(run->latencies);
+  free(run->allocation);
+  free(run);
+  return 0;
+}
+
+/** MEMORY BENCHMARK **********************************************************
+ * Reports how much memory each engine needs on a fixed set of grids, one line
+ * per measurement in a tab separated format that's meant to stay the same
+ * from one version to the next so results can be compared.
+ *
+ * For each engine there's a `setup` line for building whatever tables it needs
+ * and a `solve` line for each grid, except for the multi-source engine which
+ * solves them all at once in a single `solve` line. Each engine is measured
+ * in a process of its own, forked just for it, so that what one engine
+ * leaves behind doesn't count against the next. Each line has:
+ * - the allocations and bytes allocated, from the allocation counters;
+ * - the peak resident set size of the engine's process so far, in KB;
+ * - the frontier, path and visited footprints of the solve, computed from
+ *   `solve_stats` and the size of the structures the engine uses;
+ * - the size of the tables the engine keeps around between solves.
+ */
+
+#define MEMORY_BENCHMARK_GRIDS 5
+
+static const Grid memory_benchmark_grids[MEMORY_BENCHMARK_GRIDS] = {
+    0b0000000100000000, 0b0000000111111111, 0b0000000101010101,
+    0b0000000000010000, 0b0000000010101010};
+
+static const Engine memory_engines[] = {
+    BfsEngine,         TableEngine,    ContextEngine,   ConstructiveEngine,
+    DenseEngine,       OrbitEngine,    FogEngine,       ConstrainedEngine,
+    MultiSourceEngine, LandmarkEngine, DepthFirstEngine};
+
+typedef struct MemoryMeasure {
+  long allocations;
+  long bytes;
+} MemoryMeasure;
+
+static MemoryMeasure start_measure() {
+  return (MemoryMeasure){allocations, allocated_bytes};
+}
+
+static void report_memory(Engine engine, const char *phase, int grid,
+                          MemoryMeasure *measure, size_t frontier_entry,
+                          size_t visited_bytes, size_t table_bytes) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  char grid_text[12] = "-";
+  if (grid >= 0) {
+    format_argument(grid, grid_text);
+  }
+
+  bool solving = strcmp(phase, "solve") == 0;
+  uint32_t frontier_peak = solving ? solve_stats.frontier_peak : 0;
+  uint32_t paths_peak = solving ? solve_stats.paths_peak : 0;
+  printf("%s\t3x3\t%s\t%s\t%ld\t%ld\t%ld\t%u\t%zu\t%u\t%zu\t%zu\t%zu\n",
+         engine_names[engine], phase, grid_text,
+         allocations - measure->allocations, allocated_bytes - measure->bytes,
+         usage.ru_maxrss, frontier_peak, frontier_peak * frontier_entry,
+         paths_peak, paths_peak * sizeof(Path), solving ? visited_bytes : 0,
+         table_bytes);
+}
+
+/** Prints the memory benchmark lines of a single engine. */
+static void measure_engine_memory(Engine engine) {
+  int count = MEMORY_BENCHMARK_GRIDS;
+  int moves[511];
+  MemoryMeasure measure;
+
+  switch (engine) {
+  case BfsEngine:
+    for (int g = 0; g < count; g++) {
+      Grid grid = memory_benchmark_grids[g];
+      measure = start_measure();
+      Path *path = shortest_winning_path(grid);
+      drop_reference_to_path(path);
+      report_memory(BfsEngine, "solve", grid, &measure, sizeof(QueueNode),
+                    512, 0);
+    }
+    break;
+  case TableEngine: {
+    measure = start_measure();
+    SolutionTable *table = new_solution_table();
+    report_memory(TableEngine, "setup", -1, &measure, 0, 0,
+                  sizeof(SolutionTable));
+    for (int g = 0; table != NULL && g < count; g++) {
+      Grid grid = memory_benchmark_grids[g];
+      measure = start_measure();
+      Path *path = shortest_winning_path_with_table(table, grid);
+      drop_reference_to_path(path);
+      report_memory(TableEngine, "solve", grid, &measure, sizeof(QueueNode),
+                    512, sizeof(SolutionTable));
+    }
+    free(table);
+    break;
+  }
+  case ContextEngine: {
+    static SolverContext context;
+    init_solver_context(&context);
+    for (int g = 0; g < count; g++) {
+      Grid grid = memory_benchmark_grids[g];
+      measure = start_measure();
+      shortest_winning_moves(&context, grid, moves);
+      report_memory(ContextEngine, "solve", grid, &measure, sizeof(Grid),
+                    sizeof(context.visited_in), sizeof(SolverContext));
+    }
+    break;
+  }
+  case ConstructiveEngine: {
+    measure = start_measure();
+    ConstructiveSolver *solver = new_constructive_solver();
+    size_t solver_bytes = sizeof(ConstructiveSolver);
+    report_memory(ConstructiveEngine, "setup", -1, &measure, 0, 0,
+                  solver_bytes);
+    for (int g = 0; solver != NULL && g < count; g++) {
+      Grid grid = memory_benchmark_grids[g];
+      measure = start_measure();
+      Path *path = constructive_winning_path(solver, grid);
+      drop_reference_to_path(path);
+      report_memory(ConstructiveEngine, "solve", grid, &measure, 0, 0,
+                    solver_bytes);
+    }
+    free_constructive_solver(solver);
+    break;
+  }
+  case DenseEngine: {
+    measure = start_measure();
+    Grid starts[MEMORY_BENCHMARK_GRIDS];
+    memcpy(starts, memory_benchmark_grids, sizeof(starts));
+    DenseTables *tables = new_dense_tables(starts, count);
+    size_t dense_bytes =
+        tables == NULL ? 0 : sizeof(DenseTables) + 2 * tables->index.count;
+    report_memory(DenseEngine, "setup", -1, &measure, 0, 0, dense_bytes);
+    for (int g = 0; tables != NULL && g < count; g++) {
+      measure = start_measure();
+      dense_winning_moves(tables, starts[g], moves);
+      report_memory(DenseEngine, "solve", starts[g], &measure, 0, 0,
+                    dense_bytes);
+    }
+    free_dense_tables(tables);
+    break;
+  }
+  case OrbitEngine: {
+    measure = start_measure();
+    SolutionTable *solutions = new_solution_table();
+    OrbitTable *orbits = NULL;
+    if (solutions != NULL) {
+      extend_solution_table(solutions, 512);
+      orbits = new_orbit_table(solutions);
+      free(solutions);
+    }
+    size_t orbit_bytes =
+        orbits == NULL ? 0
+                       : sizeof(OrbitTable) + sizeof(Symmetries) +
+                             (2 + sizeof(Grid)) * orbits->symmetries->orbits;
+    report_memory(OrbitEngine, "setup", -1, &measure, 0, 0, orbit_bytes);
+    for (int g = 0; orbits != NULL && g < count; g++) {
+      measure = start_measure();
+      orbit_winning_moves(orbits, memory_benchmark_grids[g], moves);
+      report_memory(OrbitEngine, "solve", memory_benchmark_grids[g], &measure,
+                    0, 0, orbit_bytes);
+    }
+    free_orbit_table(orbits);
+    break;
+  }
+  case FogEngine:
+    for (int g = 0; g < count; g++) {
+      // A single hidden cell, so that beliefs hold two grids.
+      measure = start_measure();
+      fog_winning_moves(memory_benchmark_grids[g], cell9, moves);
+      report_memory(FogEngine, "solve", memory_benchmark_grids[g], &measure,
+                    sizeof(BeliefNode), sizeof(int) * 2 * MAX_BELIEFS, 0);
+    }
+    break;
+  case ConstrainedEngine: {
+    Constraints constraints = no_constraints();
+    constraints.max_explosions[5] = 3;
+    StateLayout layout;
+    layout_state(&constraints, &layout);
+    for (int g = 0; g < count; g++) {
+      measure = start_measure();
+      constrained_winning_moves(&constraints, memory_benchmark_grids[g],
+                                moves);
+      report_memory(ConstrainedEngine, "solve", memory_benchmark_grids[g],
+                    &measure, sizeof(ConstrainedNode),
+                    constrained_visited_bytes(&layout), 0);
+    }
+    break;
+  }
+  case MultiSourceEngine: {
+    Grid starts[MEMORY_BENCHMARK_GRIDS];
+    int lengths[MEMORY_BENCHMARK_GRIDS];
+    static int batch_moves[MEMORY_BENCHMARK_GRIDS][511];
+    memcpy(starts, memory_benchmark_grids, sizeof(starts));
+    measure = start_measure();
+    multi_source_winning_moves(starts, count, lengths, batch_moves);
+    // The frontier counts grids, each with the mask of the queries that
+    // reached it.
+    report_memory(MultiSourceEngine, "solve", -1, &measure, sizeof(QueryMask),
+                  sizeof(QueryMask[512]), 0);
+    break;
+  }
+  case LandmarkEngine: {
+    measure = start_measure();
+    MoveGraph *graph = new_move_graph();
+    Landmarks *landmarks = graph == NULL ? NULL : new_landmarks(graph, 4);
+    report_memory(LandmarkEngine, "setup", -1, &measure, 0, 0,
+                  sizeof(MoveGraph) + sizeof(Landmarks));
+    for (int g = 0; landmarks != NULL && g < count; g++) {
+      measure = start_measure();
+      landmark_moves(landmarks, memory_benchmark_grids[g], winning_grid,
+                     moves);
+      report_memory(LandmarkEngine, "solve", memory_benchmark_grids[g],
+                    &measure, sizeof(HeapEntry), 512 * 3,
+                    sizeof(MoveGraph) + sizeof(Landmarks));
+    }
+    free(landmarks);
+    free(graph);
+    break;
+  }
+  case DepthFirstEngine: {
+    measure = start_measure();
+    TranspositionTable *transpositions = new_transposition_table(64 * 1024);
+    size_t transposition_bytes =
+        transpositions == NULL
+            ? 0
+            : transpositions->bucket_count * sizeof(TranspositionBucket);
+    report_memory(DepthFirstEngine, "setup", -1, &measure, 0, 0,
+                  transposition_bytes);
+    for (int g = 0; transpositions != NULL && g < count; g++) {
+      measure = start_measure();
+      depth_first_winning_moves(transpositions, memory_benchmark_grids[g],
+                                moves);
+      // The frontier is the current path, one move per level.
+      report_memory(DepthFirstEngine, "solve", memory_benchmark_grids[g],
+                    &measure, sizeof(int), 0, transposition_bytes);
+    }
+    if (transpositions != NULL) {
+      free_transposition_table(transpositions);
+    }
+    break;
+  }
+  }
+}
+
+/**
+ * `star bench-memory`
+ *
+ * Runs the memory benchmark, see above.
+ */
+static int bench_memory_command() {
+  printf("engine\tboard\tphase\tgrid\tallocations\tbytes_allocated"
+         "\tpeak_rss_kb\tfrontier_peak\tfrontier_bytes\tpaths_peak"
+         "\tpath_bytes\tvisited_bytes\ttable_bytes\n");
+
+  int engines = sizeof(memory_engines) / sizeof(Engine);
+  for (int e = 0; e < engines; e++) {
+    // Whatever is still buffered would be written by the child as well.
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+      measure_engine_memory(memory_engines[e]);
+      fflush(stdout);
+      _exit(0);
+    }
+
+    int status;
+    if (child < 0 || waitpid(child, &status, 0) != child ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * `star trace FILE`
+ *
+ * Prints all the solves captured in a trace file, one per line.
+ */
+static int trace_command(int argc, char **argv) {
+  (void)argc;
+  FILE *in = fopen(argv[0], "rb");
+  if (in == NULL) {
+    return 1;
+  }
+
+  char magic[sizeof(capture_magic)];
+  if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+      memcmp(magic, capture_magic, sizeof(magic)) != 0) {
+    printf("Not a trace file: %s\n", argv[0]);
+    fclose(in);
+    return 1;
+  }
+
+  unsigned char record[CAPTURE_RECORD_SIZE];
+  printf("timestamp\tlatency_ns\trule_set\tgrid\tengine\n");
+  while (fread(record, 1, sizeof(record), in) == sizeof(record)) {
+    char grid[12];
+    int engine = record[16];
+    format_argument(get_little_endian(record + 14, 2) & full_grid, grid);
+    printf("%llu\t%llu\t%llu\t%s\t%s\n",
+           (unsigned long long)get_little_endian(record, 8),
+           (unsigned long long)get_little_endian(record + 8, 4),
+           (unsigned long long)get_little_endian(record + 12, 2), grid,
+           engine <= MultiSourceEngine ? engine_names[engine] : "unknown");
+  }
+
+  fclose(in);
+  return 0;
+}
+
+static int run_command(int argc, char **argv) {
+  if (argc >= 3 && strcmp(argv[1], "table") == 0) {
+    return table_command(argc - 2, argv + 2);
+  } else if (argc == 3 && strcmp(argv[1], "graph") == 0) {
+    return graph_command(argc - 2, argv + 2);
+  } else if (argc >= 3 && strcmp(argv[1], "chase") == 0) {
+    return chase_command(argc - 2, argv + 2);
+  } else if (argc == 2 && strcmp(argv[1], "components") == 0) {
+    return components_command();
+  } else if (argc >= 3 && strcmp(argv[1], "dense") == 0) {
+    return dense_command(argc - 2, argv + 2);
+  } else if (argc >= 2 && strcmp(argv[1], "orbits") == 0) {
+    return orbits_command(argc - 2, argv + 2);
+  } else if (argc >= 3 && strcmp(argv[1], "record") == 0) {
+    return record_command(argc - 2, argv + 2);
+  } else if (argc >= 2 && strcmp(argv[1], "batch") == 0) {
+    return batch_command(argc - 2, argv + 2);
+  } else if (argc >= 3 && strcmp(argv[1], "fog") == 0) {
+    return fog_command(argc - 2, argv + 2);
+  } else if (argc >= 3 && strcmp(argv[1], "constrained") == 0) {
+    return constrained_command(argc - 2, argv + 2);
+  } else if (argc >= 3 && strcmp(argv[1], "multi") == 0) {
+    return multi_command(argc - 2, argv + 2);
+  } else if (argc >= 4 && strcmp(argv[1], "oracle") == 0) {
+    return oracle_command(argc - 2, argv + 2);
+  } else if (argc >= 2 && argc <= 3 && strcmp(argv[1], "depth-first") == 0) {
+    return depth_first_command(argc - 2, argv + 2);
+  } else if (argc >= 2 && argc <= 3 && strcmp(argv[1], "shards") == 0) {
+    return shards_command(argc - 2, argv + 2);
+  } else if (argc >= 2 && argc <= 3 && strcmp(argv[1], "stream") == 0) {
+    return stream_command(argc - 2, argv + 2);
+  } else if (argc >= 2 && argc <= 3 && strcmp(argv[1], "hot-swap") == 0) {
+    return hot_swap_command(argc - 2, argv + 2);
+  } else if (argc >= 2 && argc <= 3 && strcmp(argv[1], "warm-restart") == 0) {
+    return warm_restart_command(argc - 2, argv + 2);
+  } else if (argc >= 3 && strcmp(argv[1], "steps") == 0) {
+    return steps_command(argc - 2, argv + 2);
+  } else if (argc >= 2 && argc <= 3 && strcmp(argv[1], "bench-scaling") == 0) {
+    return bench_scaling_command(argc - 2, argv + 2);
+  } else if (argc == 2 && strcmp(argv[1], "bench-memory") == 0) {
+    return bench_memory_command();
+  } else if (argc == 3 && strcmp(argv[1], "trace") == 0) {
+    return trace_command(argc - 2, argv + 2);
+  } else if (argc == 2 && strcmp(argv[1], "zero-alloc") == 0) {
+    return zero_alloc_command();
+  }
+
+  // We play all possible games in silent mode to check if we can ever leak any
+  // memory.
+  // for (int grid = empty_grid; grid < 512; grid++) {
+  //  play(grid, Silent);
+  //}
+
+  play(0b100000000, Chatty);
+  return 0;
+}
+
+/**
+ * Setting `STAR_CAPTURE` to a file name captures all solves to that file, see
+ * `start_capture`. `STAR_CAPTURE_MAX_BYTES` sets the size at which the file is
+ * rotated, 64MB by default. `STAR_CAPTURE_APPEND` is set by a program that
+ * restarts itself, so that the new one adds to its capture.
+ */
+int main(int argc, char **argv) {
+  signal(SIGUSR1, request_flight_recorder_dump);
+  take_over_tables();
+
+  char *capture_path = getenv("STAR_CAPTURE");
+  char *capture_max_bytes = getenv("STAR_CAPTURE_MAX_BYTES");
+  bool capture_append = getenv("STAR_CAPTURE_APPEND") != NULL;
+  unsetenv("STAR_CAPTURE_APPEND");
+  if (capture_path != NULL &&
+      !start_capture(capture_path,
+                     capture_max_bytes != NULL ? atol(capture_max_bytes)
+                                               : 64 * 1024 * 1024,
+                     capture_append)) {
+    fprintf(stderr, "Couldn't capture to %s\n", capture_path);
+  }
+
+  int status = run_command(argc, argv);
+  long dropped = stop_capture();
+  if (dropped > 0) {
+    fprintf(stderr, "%ld solves were not captured\n", dropped);
+  }
+  return status;
 }